@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+// Counts the heap allocations of the whole program by replacing the global operator new. The replacement can only be
+// defined once per binary: include this in a single translation unit of the binaries that want the numbers (the
+// benchmarks and the tests), the app keeps the default allocator. Aligned allocations are not counted.
+struct AllocStats {
+  uint64_t count;
+  uint64_t bytes;
+
+  AllocStats operator-(AllocStats const &other) const {
+    return AllocStats{count - other.count, bytes - other.bytes};
+  }
+};
+
+static atomic<uint64_t> allocCount{0};
+static atomic<uint64_t> allocBytes{0};
+
+AllocStats allocStats() {
+  return AllocStats{allocCount.load(memory_order_relaxed), allocBytes.load(memory_order_relaxed)};
+}
+
+// Not inlined, or GCC sees malloc / free behind new / delete and reports them as mismatched.
+[[gnu::noinline]] void *operator new(size_t size) {
+  allocCount.fetch_add(1, memory_order_relaxed);
+  allocBytes.fetch_add(size, memory_order_relaxed);
+
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw bad_alloc();
+  return p;
+}
+
+[[gnu::noinline]] void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+[[gnu::noinline]] void operator delete(void *p) noexcept {
+  free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void *p) noexcept {
+  free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept {
+  free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void *p, size_t) noexcept {
+  free(p);
+}
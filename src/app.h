@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
 #include <cstring>
 #include <filesystem>
@@ -9,14 +10,21 @@
 
 #include "ast.h"
 #include "config.h"
+#include "file_watcher.h"
 #include "imgui.h"
+#include "memory_stats.h"
 #include "logo.h"
 #include "parser.h"
 #include "raylib.h"
 #include "raymath.h"
+#include "refinement.h"
 #include "rlImGui.h"
+#include "sampler.h"
 #include "text_input.h"
+#include "tile_cache.h"
+#include "trace.h"
 #include "util.h"
+#include "vector_export.h"
 #include "vm.h"
 
 using namespace std;
@@ -24,16 +32,31 @@ using namespace std;
 enum ScriptReload {
   No,
   Light,
+  // Only root variables changed (see App::changedVars), the program can resume from a checkpoint.
+  Variables,
+  // The source was edited, the program can resume from the first top-level statement that changed.
+  Source,
   Light_and_state,
+  // A setting of the run changed (culling, level of detail, profiler): the program is executed again, the drawing
+  // can't be moved or resumed.
+  Settings,
   Full,
 };
 
 constexpr int INTVARLIMIT = 64;
 constexpr int FLOATVARLIMIT = 64;
 
-// We need to render the logo drawing high scale as textures rasterize lines without smoothing. Downscaling gives
-// us a little bit of smooothing. 2 seems to be the sweet spot with trilinear texture filter.
-constexpr float DRAW_TEXTURE_SCALE = 2.f;
+constexpr float MIN_ZOOM = 1.f / 64.f;
+constexpr float MAX_ZOOM = 4096.f;
+constexpr float ZOOM_STEP = 1.25f;
+// Execution culling keeps the calls within this many view sizes around the view, and runs the script again once the
+// view gets CULL_RERUN_ZOOM times smaller than the culled area.
+constexpr float CULL_MARGIN = 0.5f;
+constexpr float CULL_RERUN_ZOOM = 4.f;
+// With level of detail the script runs again once the view is zoomed in LOD_RERUN_ZOOM times from the run's zoom.
+constexpr float LOD_RERUN_ZOOM = 2.f;
+
+constexpr const char *DEFAULT_TRACE_PATH = "plogo_trace.json";
 
 const vector<string> builtInFunctions{
     "[f]orward(NUM)",
@@ -63,12 +86,15 @@ const vector<string> builtInFunctions{
 };
 
 struct App {
+  // The trace is written there on exit, if set.
+  string tracePath{};
+
   App() = default;
   App(const App &) = delete;
   App(App &&) = delete;
 
   void destruct_assets() {
-    UnloadRenderTexture(drawTexture);
+    tileCache.unload();
   }
 
   void init() {
@@ -76,8 +102,6 @@ struct App {
     InitWindow(config.win_w, config.win_h, "P-Logo V(0)");
     SetTargetFPS(30);
 
-    init_render_texture();
-
     rlImGuiSetup(true);
 
     textInput.init();
@@ -85,10 +109,14 @@ struct App {
     winWidth = GetScreenWidth();
     winHeight = GetScreenHeight();
 
+    // The world is as big as the initial window, resizing the window only changes the view.
+    vm.worldSize = Vector2{(float)config.win_w, (float)config.win_h};
     vm.reset();
 
-    vstartx = GetScreenWidth() >> 1;
-    vstarty = GetScreenHeight() >> 1;
+    resetCamera();
+
+    vstartx = config.win_w >> 1;
+    vstarty = config.win_h >> 1;
     vstartangle = 0;
   }
 
@@ -100,26 +128,36 @@ struct App {
     }
 
     INFO("Loading script: %s", sourceFileName);
+    sampler.setScript(sourceFileName);
 
-    sourceFileUpdateTime = getSourceFileUpdateTime();
+    sourceWatcher.watch(sourceFileName);
+    readSourceFile();
+  }
 
+  // Reloads the script if its content changed since the last read.
+  void readSourceFile() {
+    TRACE_SCOPE("read source");
     std::string fileContent;
-    std::getline(std::ifstream(sourceFileName), fileContent, '\0');
-
-    bzero(sourceCode, sizeof(sourceCode));
-    TraceLog(LOG_INFO, "Zero %d bytes", sizeof(sourceCode));
-    if (sizeof(sourceCode) > fileContent.size()) {
-      strncpy(sourceCode, fileContent.c_str(), fileContent.size());
-    } else {
-      TraceLog(LOG_WARNING, "Source code exceeds input buffer size");
+    if (!readFile(sourceFileName, fileContent)) {
+      WARN("Cannot read script: %s", sourceFileName);
+      return;
     }
 
+    size_t contentHash = hash<string>{}(fileContent);
+    if (hasSourceHash && contentHash == sourceHash) return;
+    sourceHash = contentHash;
+    hasSourceHash = true;
+
+    sourceCode = std::move(fileContent);
+
     needScriptReload = ScriptReload::Full;
     scriptReload();
   }
 
   void run() {
     while (!WindowShouldClose()) {
+      TRACE_SCOPE("frame");
+
       update();
 
       draw_draw_texture();
@@ -131,9 +169,12 @@ struct App {
       draw();
       drawPanel();
 
+      TRACE_SCOPE("present");
       EndDrawing();
     }
 
+    if (!tracePath.empty()) saveTrace(tracePath.c_str());
+
     destruct_assets();
 
     rlImGuiShutdown();
@@ -144,39 +185,120 @@ struct App {
  private:
   TextInput textInput{};
   VM vm{};
-  RenderTexture2D drawTexture;
+  TileCache tileCache{};
+  Camera2D camera{};
   int vstartx{0};
   int vstarty{0};
   int vstartangle{0};
   int needScriptReload{ScriptReload::No};
-  bool needDrawTextureRedraw{false};
+  HistoryIndex historyIndex{};
   char *sourceFileName{nullptr};
-  chrono::time_point<chrono::file_clock> sourceFileUpdateTime{};
+  FileWatcher sourceWatcher{};
+  size_t sourceHash{0};
+  bool hasSourceHash{false};
   int intVarBackend[INTVARLIMIT];
   float floatVarBackend[FLOATVARLIMIT];
   int winWidth;
   int winHeight;
-  float lastRenderTime{};
-  char sourceCode[2048]{};
+  RunTimes lastRunTimes{};
+  // The script is only lexed and parsed again when its text changed, slider and start point changes just re-execute.
+  optional<Ast::Program> program{};
+  size_t programSourceHash{0};
+  // The source the program was parsed from, edits of it are re-parsed incrementally.
+  string programSource{};
+  bool isProgramStartInvariant{false};
+  size_t historySizeAfterRun{0};
+  // Root variables changed by the sliders since the last reload.
+  vector<string> changedVars{};
+  size_t lastResumeStatement{0};
+  RefinementScheduler refinement{};
+  // Edited in place by the source code panel and lexed without a copy.
+  string sourceCode{};
   bool showSourceCode{true};
 
-  void init_render_texture() {
-    drawTexture = LoadRenderTexture(GetScreenWidth() * DRAW_TEXTURE_SCALE, GetScreenHeight() * DRAW_TEXTURE_SCALE);
-    SetTextureFilter(drawTexture.texture, TEXTURE_FILTER_TRILINEAR);
+  void resetCamera() {
+    camera.target = Vector2{vm.worldSize.x / 2.f, vm.worldSize.y / 2.f};
+    camera.offset = Vector2{GetScreenWidth() / 2.f, GetScreenHeight() / 2.f};
+    camera.rotation = 0.f;
+    camera.zoom = 1.f;
   }
 
+  // Drafts run with a coarse level of detail and a line budget, see RefinementScheduler.
   void scriptReload() {
+    TRACE_SCOPE("scriptReload");
+    bool isDraft = refinement.isDrafting(GetTime());
+
+    bool wasLodEnabled{vm.culling.isLodEnabled};
+    float lodThreshold{vm.culling.lodThreshold};
+    if (isDraft) {
+      vm.culling.isLodEnabled = true;
+      vm.culling.lodThreshold = max(lodThreshold, RefinementScheduler::DRAFT_LOD_THRESHOLD);
+      vm.lineBudget = RefinementScheduler::DRAFT_LINE_BUDGET;
+    }
+
+    // Only drafts may resume or move a draft, refining it needs a full run.
+    bool didExecute = runScriptReload(isDraft || !refinement.isDraftShown);
+
+    vm.culling.isLodEnabled = wasLodEnabled;
+    vm.culling.lodThreshold = lodThreshold;
+    vm.lineBudget = SIZE_MAX;
+
+    // A moved drawing keeps its detail.
+    if (didExecute || !isDraft) refinement.isDraftShown = isDraft;
+  }
+
+  // Returns false if the drawing was only moved, without executing the program.
+  bool runScriptReload(bool canReuseDrawing) {
     INFO("Reloading script");
 
+    size_t sourceHash = hash<string>{}(sourceCode);
+    bool isRecompiled{false};
+    // The first top-level statement that is not the same node as before the reload.
+    optional<size_t> firstChanged{nullopt};
+    if (!program.has_value() || sourceHash != programSourceHash) {
+      optional<Reparse> reparsed =
+          program.has_value() ? reparseLogo(program.value(), programSource, sourceCode, &lastRunTimes) : nullopt;
+      if (reparsed.has_value()) {
+        program = std::move(reparsed->program);
+        firstChanged = reparsed->firstChanged;
+        // What culling learned is keyed by function node, and the effect of a call depends on the functions it calls.
+        if (reparsed->didFunctionsChange) vm.culling.clear();
+      } else {
+        program = compileLogo(sourceCode, &lastRunTimes);
+        isRecompiled = true;
+        vm.culling.clear();
+      }
+      programSource = sourceCode;
+      programSourceHash = sourceHash;
+      isProgramStartInvariant = program.has_value() && Ast::isStartInvariant(program.value());
+    } else {
+      lastRunTimes.parse = 0.f;
+    }
+
+    bool canResume = canReuseDrawing && !isRecompiled && program.has_value();
+    if ((needScriptReload == ScriptReload::Variables || needScriptReload == ScriptReload::Source) && canResume &&
+        resumeProgram(firstChanged)) {
+      finishScriptReload();
+      return true;
+    }
+    if (needScriptReload == ScriptReload::Light_and_state && canResume && !firstChanged.has_value() &&
+        changedVars.empty() && moveProgramStart()) {
+      finishScriptReload();
+      return false;
+    }
+    if (needScriptReload == ScriptReload::Variables || needScriptReload == ScriptReload::Source) {
+      needScriptReload = ScriptReload::Light_and_state;
+    }
+
     int i = 0;
     for (auto &[k, v] : vm.intVars) {
-      vm.frames.front().variables[k].floatVal = (float)intVarBackend[i];
+      vm.frames.front().variable(k).floatVal = (float)intVarBackend[i];
       i++;
     }
 
     i = 0;
     for (auto &[k, v] : vm.floatVars) {
-      vm.frames.front().variables[k].floatVal = floatVarBackend[i];
+      vm.frames.front().variable(k).floatVal = floatVarBackend[i];
       i++;
     }
 
@@ -188,67 +310,197 @@ struct App {
       vm.angle = vstartangle;
     }
 
-    runLogo(sourceCode, &vm, &lastRenderTime);
-    needDrawTextureRedraw = true;
+    // The culling rect and LOD scale only change on full runs, resumed runs have to cull like the part of the run they
+    // keep.
+    vm.culling.rect = cullRectForView();
+    vm.culling.lodScale = camera.zoom;
+    vm.culling.skippedCallCount = 0;
+    vm.culling.prunedCallCount = 0;
+
+    lastResumeStatement = 0;
+    if (program.has_value()) executeLogo(program.value(), &vm, &lastRunTimes, 0);
+
+    finishScriptReload();
+    return true;
+  }
+
+  // Re-executes the program from the first top-level statement that accessed a changed variable or was edited
+  // (`firstChanged`), the statements before keep their drawing (even if they used rand()).
+  bool resumeProgram(optional<size_t> firstChanged) {
+    if (!vm.isCheckpointComplete) return false;
+
+    optional<size_t> first = vm.firstStatementAccessing(changedVars);
+    if (firstChanged.has_value()) first = min(first.value_or(SIZE_MAX), firstChanged.value());
+    size_t statementCount = program.value().statements.size();
+
+    // Statements were only added after the end: the VM is in the state they start from. Otherwise the program resumes
+    // from the closest checkpoint.
+    size_t resumeFrom = first.value_or(statementCount);
+    bool isAtEnd = first.has_value() && first.value() == vm.checkpointedStatementCount;
+    if (first.has_value() && !isAtEnd) {
+      optional<size_t> restored = vm.restoreCheckpoint(first.value());
+      if (!restored.has_value()) return false;
+      resumeFrom = restored.value();
+    }
+
+    // Variables accessed before the resumed statement have their values from the checkpoint, the rest start from
+    // the sliders like in a full run.
+    int i = 0;
+    for (auto &[k, v] : vm.intVars) {
+      if (vm.firstStatementAccessing({k}).value_or(statementCount) >= resumeFrom) {
+        vm.frames.front().variable(k).floatVal = (float)intVarBackend[i];
+      }
+      i++;
+    }
 
     i = 0;
+    for (auto &[k, v] : vm.floatVars) {
+      if (vm.firstStatementAccessing({k}).value_or(statementCount) >= resumeFrom) {
+        vm.frames.front().variable(k).floatVal = floatVarBackend[i];
+      }
+      i++;
+    }
+
+    lastResumeStatement = resumeFrom;
+    // Nothing read the changed variables, the drawing stays the same.
+    if (!first.has_value()) return true;
+
+    lastRunTimes.execute = 0.f;
+    executeLogo(program.value(), &vm, &lastRunTimes, resumeFrom);
+    return true;
+  }
+
+  // A new start point of a start invariant program only moves the drawing, no need to run it again.
+  bool moveProgramStart() {
+    if (!program.has_value() || !isProgramStartInvariant || vm.history.size() != historySizeAfterRun) return false;
+    // A culled drawing is incomplete, moving it would bring the missing parts into the view.
+    if (vm.culling.isEnabled) return false;
+    if (!vm.transformFromStart(Vector2{(float)vstartx, (float)vstarty}, (float)vstartangle)) return false;
+
+    lastRunTimes.execute = 0.f;
+    lastResumeStatement = program.value().statements.size();
+    return true;
+  }
+
+  void finishScriptReload() {
+    historySizeAfterRun = vm.history.size();
+    {
+      TRACE_SCOPE("index build");
+      historyIndex.build(vm);
+    }
+
+    int i = 0;
     for (auto &[k, v] : vm.intVars) {
-      intVarBackend[i] = (int)vm.frames.front().variables[k].floatVal;
+      intVarBackend[i] = (int)vm.frames.front().variable(k).floatVal;
       i++;
     }
 
     i = 0;
     for (auto &[k, v] : vm.floatVars) {
-      floatVarBackend[i] = vm.frames.front().variables[k].floatVal;
+      floatVarBackend[i] = vm.frames.front().variable(k).floatVal;
       i++;
     }
 
+    changedVars.clear();
     needScriptReload = ScriptReload::No;
   }
 
   void update() {
+    TRACE_SCOPE("update");
     if (winWidth != GetScreenWidth() || winHeight != GetScreenHeight()) {
+      // Keep the world point in the middle of the window in place.
+      camera.offset.x += (GetScreenWidth() - winWidth) / 2.f;
+      camera.offset.y += (GetScreenHeight() - winHeight) / 2.f;
+
       winWidth = GetScreenWidth();
       winHeight = GetScreenHeight();
+    }
+
+    updateCamera();
 
-      UnloadRenderTexture(drawTexture);
-      init_render_texture();
+    // The view outgrew the area or the detail of the last run.
+    if (needScriptReload < ScriptReload::Settings &&
+        ((vm.culling.isEnabled && isViewOutsideCulling()) ||
+         (vm.culling.isLodEnabled && camera.zoom > vm.culling.lodScale * LOD_RERUN_ZOOM))) {
+      needScriptReload = ScriptReload::Settings;
     }
 
-    if (IsMouseButtonPressed(1)) {
-      vstartx = GetMousePosition().x;
-      vstarty = GetMousePosition().y;
-      needScriptReload = ScriptReload::Light_and_state;
+    if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT) && !ImGui::GetIO().WantCaptureMouse) {
+      Vector2 start = GetScreenToWorld2D(GetMousePosition(), camera);
+      vstartx = start.x;
+      vstarty = start.y;
+      needScriptReload = max(needScriptReload, (int)ScriptReload::Light_and_state);
     }
 
     checkSourceForUpdates();
 
+    if (needScriptReload == ScriptReload::No && refinement.needsRefinement(GetTime())) {
+      needScriptReload = ScriptReload::Light_and_state;
+    }
+
     if (needScriptReload > ScriptReload::No) scriptReload();
 
     if (!showSourceCode) {
       auto command = textInput.update();
       if (command.has_value()) {
-        runLogo(command.value().c_str(), &vm, &lastRenderTime);
-        needDrawTextureRedraw = true;
+        runLogo(command.value(), &vm, &lastRunTimes);
       }
     }
   }
 
-  void checkSourceForUpdates() {
-    if (sourceFileName == nullptr) return;
+  Rectangle viewRect() const {
+    Vector2 topLeft = GetScreenToWorld2D(Vector2{0.f, 0.f}, camera);
+    Vector2 bottomRight = GetScreenToWorld2D(Vector2{(float)GetScreenWidth(), (float)GetScreenHeight()}, camera);
+    return Rectangle{topLeft.x, topLeft.y, bottomRight.x - topLeft.x, bottomRight.y - topLeft.y};
+  }
+
+  Rectangle cullRectForView() const {
+    Rectangle view = viewRect();
+    return Rectangle{view.x - view.width * CULL_MARGIN, view.y - view.height * CULL_MARGIN,
+                     view.width * (1.f + CULL_MARGIN * 2.f), view.height * (1.f + CULL_MARGIN * 2.f)};
+  }
+
+  // The culled drawing is missing parts of the view, or is much coarser than what culling the view could give.
+  bool isViewOutsideCulling() const {
+    Rectangle view = viewRect();
+    Rectangle const &cull = vm.culling.rect;
+    bool isInside = view.x >= cull.x && view.y >= cull.y && view.x + view.width <= cull.x + cull.width &&
+                    view.y + view.height <= cull.y + cull.height;
+    return !isInside || view.width * CULL_RERUN_ZOOM < cull.width / (1.f + CULL_MARGIN * 2.f);
+  }
+
+  // Mouse wheel zooms around the cursor, dragging with the left or middle button pans.
+  void updateCamera() {
+    if (ImGui::GetIO().WantCaptureMouse) return;
 
-    auto currentTime = getSourceFileUpdateTime();
-    if (currentTime != sourceFileUpdateTime) {
-      loadSourceFile(sourceFileName);
+    float wheel = GetMouseWheelMove();
+    if (wheel != 0.f) {
+      Vector2 mouseWorld = GetScreenToWorld2D(GetMousePosition(), camera);
+      camera.offset = GetMousePosition();
+      camera.target = mouseWorld;
+      camera.zoom = toRange(camera.zoom * powf(ZOOM_STEP, wheel), MIN_ZOOM, MAX_ZOOM);
+    }
+
+    if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) || IsMouseButtonDown(MOUSE_BUTTON_MIDDLE)) {
+      Vector2 delta = GetMouseDelta();
+      camera.target.x -= delta.x / camera.zoom;
+      camera.target.y -= delta.y / camera.zoom;
     }
   }
 
-  chrono::time_point<chrono::file_clock> getSourceFileUpdateTime() const {
-    filesystem::path p{sourceFileName};
-    return filesystem::last_write_time(p);
+  void checkSourceForUpdates() {
+    if (sourceFileName == nullptr) return;
+
+    bool didChange;
+    {
+      TRACE_SCOPE("file watch");
+      didChange = sourceWatcher.poll();
+    }
+    if (didChange) readSourceFile();
   }
 
   void drawPanel() {
+    TRACE_SCOPE("ImGui");
     rlImGuiBegin();
     ImGui::Begin("Toolbar");
 
@@ -264,6 +516,7 @@ struct App {
 
   void drawToolbarVariables() {
     bool didChange{false};
+    bool isSliderActive{false};
     int prevVstartx{vstartx};
     int prevVstarty{vstarty};
     int prevVstartangle{vstartangle};
@@ -274,9 +527,13 @@ struct App {
     int i = 0;
     for (auto &[k, v] : vm.intVars) {
       bool changed = ImGui::SliderInt(k.c_str(), intVarBackend + i, v.min, v.max);
+      isSliderActive = isSliderActive || ImGui::IsItemActive();
 
-      if (changed) didChange = true;
-      vm.frames.front().variables[k].floatVal = static_cast<float>(intVarBackend[i]);
+      if (changed) {
+        didChange = true;
+        changedVars.push_back(k);
+      }
+      vm.frames.front().variable(k).floatVal = static_cast<float>(intVarBackend[i]);
 
       i++;
     }
@@ -284,10 +541,12 @@ struct App {
     int j = 0;
     for (auto &[k, v] : vm.floatVars) {
       bool changed = ImGui::SliderFloat(k.c_str(), floatVarBackend + j, v.min, v.max);
+      isSliderActive = isSliderActive || ImGui::IsItemActive();
 
       if (changed) {
         didChange = true;
-        vm.frames.front().variables[k].floatVal = floatVarBackend[j];
+        changedVars.push_back(k);
+        vm.frames.front().variable(k).floatVal = floatVarBackend[j];
       }
 
       j++;
@@ -295,34 +554,147 @@ struct App {
 
     ImGui::Separator();
 
-    ImGui::SliderInt("Start x", &vstartx, 0, GetScreenWidth());
-    ImGui::SliderInt("Start y", &vstarty, 0, GetScreenHeight());
+    ImGui::SliderInt("Start x", &vstartx, 0, vm.worldSize.x);
+    isSliderActive = isSliderActive || ImGui::IsItemActive();
+    ImGui::SliderInt("Start y", &vstarty, 0, vm.worldSize.y);
+    isSliderActive = isSliderActive || ImGui::IsItemActive();
     ImGui::SliderInt("Start angle", &vstartangle, 0, 360);
+    isSliderActive = isSliderActive || ImGui::IsItemActive();
 
-    if (needScriptReload <= ScriptReload::Light &&
-        (didChange || vstartx != prevVstartx || vstarty != prevVstarty || vstartangle != prevVstartangle)) {
+    bool didStartChange = vstartx != prevVstartx || vstarty != prevVstarty || vstartangle != prevVstartangle;
+    refinement.updateSliders(isSliderActive, didChange || didStartChange, GetTime());
+    if (needScriptReload < ScriptReload::Light_and_state && didStartChange) {
       needScriptReload = ScriptReload::Light_and_state;
+    } else if (needScriptReload <= ScriptReload::Light && didChange) {
+      needScriptReload = ScriptReload::Variables;
     }
   }
 
+  // Grows the source code string when the editor needs more room (see ImGuiInputTextFlags_CallbackResize).
+  static int resizeSourceCode(ImGuiInputTextCallbackData *data) {
+    if (data->EventFlag == ImGuiInputTextFlags_CallbackResize) {
+      auto *code = static_cast<string *>(data->UserData);
+      code->resize(data->BufTextLen);
+      data->Buf = code->data();
+    }
+    return 0;
+  }
+
   void drawSourceCode() {
     showSourceCode = ImGui::CollapsingHeader("Source code", ImGuiTreeNodeFlags_DefaultOpen);
 
     if (showSourceCode) {
-      ImGui::InputTextMultiline("source_code", sourceCode, IM_ARRAYSIZE(sourceCode),
-                                ImVec2(-FLT_MIN, ImGui::GetTextLineHeight() * 32), ImGuiInputTextFlags_AllowTabInput);
+      // Edits run right away, from the first statement they changed.
+      if (ImGui::InputTextMultiline("source_code", sourceCode.data(), sourceCode.capacity() + 1,
+                                    ImVec2(-FLT_MIN, ImGui::GetTextLineHeight() * 32),
+                                    ImGuiInputTextFlags_AllowTabInput | ImGuiInputTextFlags_CallbackResize,
+                                    resizeSourceCode, &sourceCode)) {
+        needScriptReload = max(needScriptReload, (int)ScriptReload::Source);
+      }
 
       if (ImGui::Button("Clear and run")) needScriptReload = ScriptReload::Full;
       ImGui::SameLine();
       if (ImGui::Button("Run")) needScriptReload = ScriptReload::Light;
+      ImGui::SameLine();
+      if (ImGui::Button("Export SVG")) exportDrawing(".svg");
+      ImGui::SameLine();
+      if (ImGui::Button("Export PDF")) exportDrawing(".pdf");
+    }
+  }
+
+  // Writes the drawing next to the script (or into the working directory) as a vector file.
+  void exportDrawing(const char *extension) {
+    filesystem::path outPath{sourceFileName == nullptr ? "plogo" : sourceFileName};
+    outPath.replace_extension(extension);
+
+    auto t_start = chrono::steady_clock::now();
+
+    ofstream file{outPath, ios::binary};
+    if (!file) {
+      WARN("Cannot open export file: %s", outPath.c_str());
+      return;
     }
+
+    if (outPath.extension() == ".pdf") {
+      exportPdf(vm.history, vm.worldSize, file);
+    } else {
+      exportSvg(vm.history, vm.worldSize, file);
+    }
+
+    INFO("Exported %lu edges to %s in %.2f ms", vm.history.size(), outPath.c_str(),
+         chrono::duration<float, milli>(chrono::steady_clock::now() - t_start).count());
   }
 
   void drawToolbarDebug() {
     if (ImGui::CollapsingHeader("Debug", ImGuiTreeNodeFlags_DefaultOpen)) {
       ImGui::Text("FPS: %d", GetFPS());
       ImGui::Text("Edge count: %lu", vm.history.size());
-      ImGui::Text("Render time: %.2f ms", lastRenderTime * 1000.f);
+      ImGui::Text("Run time: %.2f ms (lex + parse %.2f ms, execute %.2f ms)", lastRunTimes.total() * 1000.f,
+                  lastRunTimes.parse * 1000.f, lastRunTimes.execute * 1000.f);
+      if (program.has_value()) {
+        ImGui::Text("Resumed from statement: %lu / %lu%s", lastResumeStatement, program.value().statements.size(),
+                    isProgramStartInvariant ? " (start invariant)" : "");
+      }
+      ImGui::Text("Index build time: %.2f ms (%dx%d cells)", historyIndex.lastBuildTime * 1000.f, historyIndex.cols,
+                  historyIndex.rows);
+      ImGui::Text("Index query time: %.2f ms", historyIndex.lastQueryTime * 1000.f);
+      ImGui::Text("Zoom: %.3fx (level %d)", camera.zoom, tileCache.lastLevel);
+      ImGui::Text("Tiles: %lu cached, %d rasterized, %d fallback, %d missing", tileCache.tiles.size(),
+                  tileCache.lastRasterCount, tileCache.lastFallbackCount, tileCache.lastMissingCount);
+      if (ImGui::Button("Reset view")) resetCamera();
+      ImGui::SameLine();
+      if (ImGui::Button("Save trace")) saveTrace(tracePath.empty() ? DEFAULT_TRACE_PATH : tracePath.c_str());
+      ImGui::SameLine();
+      bool isSampling = sampler.isSampling();
+      if (ImGui::Checkbox("Sample call stacks", &isSampling)) {
+        if (isSampling) {
+          sampler.start();
+        } else {
+          sampler.stop();
+        }
+      }
+      if (sampler.isSampling()) {
+        ImGui::SameLine();
+        ImGui::Text("%lu samples, written to %s when stopped", sampler.sampleCount(), sampler.samplePath().c_str());
+      }
+      bool isAnalytic = tileCache.lineMode == LineMode::Analytic;
+      if (ImGui::Checkbox("Analytic anti-aliasing", &isAnalytic)) {
+        tileCache.setLineMode(isAnalytic ? LineMode::Analytic : LineMode::Supersampled);
+      }
+      if (ImGui::Checkbox("Cull off-screen calls", &vm.culling.isEnabled)) {
+        needScriptReload = max(needScriptReload, (int)ScriptReload::Settings);
+      }
+      if (vm.culling.isEnabled) {
+        ImGui::SameLine();
+        ImGui::Text("%d calls skipped, %lu call effects learned", vm.culling.skippedCallCount,
+                    vm.culling.effects.size());
+      }
+      if (ImGui::Checkbox("Level of detail", &vm.culling.isLodEnabled)) {
+        needScriptReload = max(needScriptReload, (int)ScriptReload::Settings);
+      }
+      if (vm.culling.isLodEnabled) {
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(120.f);
+        if (ImGui::SliderFloat("##lodThreshold", &vm.culling.lodThreshold, 0.05f, 4.f, "%.2f px")) {
+          needScriptReload = max(needScriptReload, (int)ScriptReload::Settings);
+        }
+        ImGui::SameLine();
+        ImGui::Text("%d calls pruned", vm.culling.prunedCallCount);
+      }
+      ImGui::Checkbox("Draft while dragging sliders", &refinement.isEnabled);
+      if (refinement.isDraftShown) {
+        ImGui::SameLine();
+        ImGui::Text("(draft shown)");
+      }
+
+      auto hoveredLine =
+          historyIndex.hitTest(vm, GetScreenToWorld2D(GetMousePosition(), camera), 2.f / camera.zoom);
+      if (hoveredLine.has_value()) {
+        ImGui::Text("Edge under cursor: #%u", hoveredLine.value());
+      } else {
+        ImGui::Text("Edge under cursor: -");
+      }
+      drawMemoryTable();
 
       ImGui::Separator();
 
@@ -337,6 +709,106 @@ struct App {
       for (auto &[k, v] : vm.frames.front().variables) {
         ImGui::BulletText("%s = %.2f", k.c_str(), v.floatVal);
       }
+
+      ImGui::Separator();
+
+      if (ImGui::Checkbox("Profile functions", &vm.profiler.isEnabled)) {
+        needScriptReload = max(needScriptReload, (int)ScriptReload::Settings);
+      }
+      if (vm.profiler.isEnabled) drawProfileTable();
+    }
+  }
+
+  // Calls of the last run per function, sortable by every column.
+  void drawProfileTable() {
+    if (vm.profiler.firstStatement > 0) {
+      ImGui::TextColored({1.0, 0.6, 0.6, 1.0}, "Resumed run: statements before %lu are not profiled",
+                         vm.profiler.firstStatement);
+    }
+    ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders |
+                            ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingFixedFit;
+    if (!ImGui::BeginTable("profile", 5, flags, ImVec2(0.f, ImGui::GetTextLineHeightWithSpacing() * 12.f))) return;
+
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Function", ImGuiTableColumnFlags_WidthStretch);
+    ImGui::TableSetupColumn("Calls", ImGuiTableColumnFlags_PreferSortDescending);
+    ImGui::TableSetupColumn("Incl. ms", ImGuiTableColumnFlags_PreferSortDescending);
+    ImGui::TableSetupColumn("Excl. ms", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending);
+    ImGui::TableSetupColumn("Segments", ImGuiTableColumnFlags_PreferSortDescending);
+    ImGui::TableHeadersRow();
+
+    vector<ProfileRow> rows = vm.profiler.rows();
+    ImGuiTableSortSpecs *sortSpecs = ImGui::TableGetSortSpecs();
+    if (sortSpecs != nullptr && sortSpecs->SpecsCount > 0) {
+      int column = sortSpecs->Specs[0].ColumnIndex;
+      bool isAscending = sortSpecs->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+      auto key = [&](ProfileRow const &row) -> double {
+        switch (column) {
+          case 1:
+            return (double)row.stats.calls;
+          case 2:
+            return row.stats.inclusive;
+          case 3:
+            return row.stats.exclusive;
+          case 4:
+            return (double)row.stats.segments;
+          default:
+            return 0.0;
+        }
+      };
+      sort(rows.begin(), rows.end(), [&](ProfileRow const &a, ProfileRow const &b) {
+        if (column == 0) return isAscending ? a.name < b.name : a.name > b.name;
+        return isAscending ? key(a) < key(b) : key(a) > key(b);
+      });
+    }
+
+    for (auto const &row : rows) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("%s%s", row.name.c_str(), row.isBuiltin ? "" : "()");
+      ImGui::TableNextColumn();
+      ImGui::Text("%lu", row.stats.calls);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", row.stats.inclusive * 1000.0);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", row.stats.exclusive * 1000.0);
+      ImGui::TableNextColumn();
+      ImGui::Text("%lu", row.stats.segments);
+    }
+
+    ImGui::EndTable();
+  }
+
+  // Live and peak bytes by what they are used for, see MemoryStats.
+  void drawMemoryTable() {
+    ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit;
+    if (!ImGui::BeginTable("memory", 3, flags)) return;
+
+    ImGui::TableSetupColumn("Memory");
+    ImGui::TableSetupColumn("Live MB");
+    ImGui::TableSetupColumn("Peak MB");
+    ImGui::TableHeadersRow();
+
+    for (int i = 0; i < MEMORY_KIND_COUNT; i++) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Text("%s", MEMORY_KIND_NAMES[i]);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", memoryStats.live((MemoryKind)i) / 1e6);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.2f", memoryStats.peak((MemoryKind)i) / 1e6);
+    }
+
+    ImGui::EndTable();
+  }
+
+  void saveTrace(const char *path) {
+    ofstream file{path};
+    size_t eventCount = tracer.writeChromeJson(file);
+    if (file.good()) {
+      appLog.append(TextFormat("[INFO] saved %lu trace events to %s", eventCount, path));
+    } else {
+      WARN("Cannot write trace: %s", path);
     }
   }
 
@@ -350,11 +822,13 @@ struct App {
     if (ImGui::CollapsingHeader("Reference")) {
       ImGui::TextColored({1.0, 1.0, 0.6, 1.0}, "Custom functions:");
       for (auto &[k, v] : vm.functions) {
+        if (v == nullptr) continue;
+
         string signature{k};
         signature += "(";
 
         for (unsigned int i = 0; i < v->argNames.size(); i++) {
-          signature += v->argNames[i];
+          signature += *v->argNames[i];
           if (i < v->argNames.size() - 1) signature += ",";
         }
 
@@ -371,37 +845,23 @@ struct App {
     }
   }
 
-  void draw() const {
-    DrawTextureEx(drawTexture.texture, Vector2Zero(), 0.f, 1.f / DRAW_TEXTURE_SCALE, WHITE);
+  void draw() {
+    TRACE_SCOPE("draw");
+    tileCache.draw(camera);
 
     if (!showSourceCode) textInput.draw();
 
     // Draw turtle (triangle).
-    Vector2 p1 = Vector2Add(Vector2Rotate(Vector2{0.0f, -12.0f}, vm.rad()), vm.pos);
-    Vector2 p2 = Vector2Add(Vector2Rotate(Vector2{-6.0f, 8.0f}, vm.rad()), vm.pos);
-    Vector2 p3 = Vector2Add(Vector2Rotate(Vector2{6.0f, 8.0f}, vm.rad()), vm.pos);
+    Vector2 turtlePos = GetWorldToScreen2D(vm.pos, camera);
+    Vector2 p1 = Vector2Add(Vector2Rotate(Vector2{0.0f, -12.0f}, vm.rad()), turtlePos);
+    Vector2 p2 = Vector2Add(Vector2Rotate(Vector2{-6.0f, 8.0f}, vm.rad()), turtlePos);
+    Vector2 p3 = Vector2Add(Vector2Rotate(Vector2{6.0f, 8.0f}, vm.rad()), turtlePos);
     DrawTriangle(p1, p2, p3, GREEN);
   }
 
   void draw_draw_texture() {
-    if (!needDrawTextureRedraw) return;
-
-    Vector2 start{};
-    Vector2 end{};
-
-    BeginTextureMode(drawTexture);
-    DrawRectangle(0, 0, GetScreenWidth() * DRAW_TEXTURE_SCALE, GetScreenHeight() * DRAW_TEXTURE_SCALE, WHITE);
-    for (auto const &line : vm.history) {
-      start.x = line.from.x * DRAW_TEXTURE_SCALE;
-      start.y = (GetScreenHeight() - line.from.y) * DRAW_TEXTURE_SCALE;
-
-      end.x = line.to.x * DRAW_TEXTURE_SCALE;
-      end.y = (GetScreenHeight() - line.to.y) * DRAW_TEXTURE_SCALE;
-
-      DrawLineEx(start, end, line.thickness * DRAW_TEXTURE_SCALE, line.color);
-    }
-    EndTextureMode();
-
-    needDrawTextureRedraw = false;
+    TRACE_SCOPE("rasterize tiles");
+    tileCache.sync(vm, historyIndex);
+    tileCache.update(vm, historyIndex, camera, GetScreenWidth(), GetScreenHeight());
   }
 };
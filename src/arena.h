@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "memory_stats.h"
+
+using namespace std;
+
+// A list of objects in an arena, fixed once built.
+template <typename T>
+struct ArenaList {
+  T *items{nullptr};
+  size_t count{0};
+
+  size_t size() const {
+    return count;
+  }
+  bool empty() const {
+    return count == 0;
+  }
+  T &operator[](size_t i) const {
+    return items[i];
+  }
+  T *begin() const {
+    return items;
+  }
+  T *end() const {
+    return items + count;
+  }
+};
+
+// Bump allocator: objects are placed one after the other in chunks and are never destroyed on their own, the arena
+// frees all of them at once by dropping its chunks. Only trivially destructible objects can be made in it. Its chunks
+// are counted into `kind`.
+struct Arena {
+  static constexpr size_t MIN_CHUNK_SIZE = 4 * 1024;
+  static constexpr size_t MAX_CHUNK_SIZE = 1024 * 1024;
+
+  MemoryKind kind;
+
+  explicit Arena(MemoryKind kind = MemoryKind::Ast) : kind(kind) {
+  }
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena() {
+    memoryStats.remove(kind, reservedBytes);
+  }
+
+  template <typename T, typename... Args>
+  T *make(Args &&...args) {
+    static_assert(is_trivially_destructible_v<T>, "Arena objects are not destroyed");
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  template <typename T>
+  ArenaList<T> makeList(T const *items, size_t count) {
+    static_assert(is_trivially_destructible_v<T>, "Arena objects are not destroyed");
+    if (count == 0) return ArenaList<T>{};
+
+    T *copy = static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+    uninitialized_copy(items, items + count, copy);
+    return ArenaList<T>{copy, count};
+  }
+
+  void *allocate(size_t size, size_t alignment) {
+    size_t offset = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+    if (cursor == nullptr || offset + size > static_cast<size_t>(chunkEnd - cursor)) {
+      addChunk(size + alignment);
+      offset = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+    }
+
+    void *p = cursor + offset;
+    cursor += offset + size;
+    usedBytes += offset + size;
+    return p;
+  }
+
+  // Bytes handed out (with alignment padding), and bytes of all chunks.
+  size_t used() const {
+    return usedBytes;
+  }
+  size_t reserved() const {
+    return reservedBytes;
+  }
+
+ private:
+  vector<unique_ptr<byte[]>> chunks{};
+  byte *cursor{nullptr};
+  byte *chunkEnd{nullptr};
+  size_t usedBytes{0};
+  size_t reservedBytes{0};
+
+  // Chunks double in size, so small programs stay small and big ones take few chunks.
+  void addChunk(size_t minSize) {
+    size_t size = chunks.empty() ? MIN_CHUNK_SIZE : min(reservedBytes, MAX_CHUNK_SIZE);
+    size = max(size, minSize);
+
+    chunks.push_back(make_unique_for_overwrite<byte[]>(size));
+    cursor = chunks.back().get();
+    chunkEnd = cursor + size;
+    reservedBytes += size;
+    memoryStats.add(kind, size);
+  }
+};
@@ -3,11 +3,16 @@
 #include <algorithm>
 #include <cctype>
 #include <cmath>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <string_view>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "arena.h"
 #include "lexer.h"
 #include "util.h"
 #include "value.h"
@@ -31,206 +36,274 @@ binop      = number op binop | name op binop
 
 **/
 
+struct FnCallNode;
+struct FnDefNode;
+
+// Owns the nodes of a program and the names they refer to. Nodes are trivially destructible, so a program is freed by
+// dropping the arena chunks instead of node by node.
+struct AstStorage {
+  Arena arena{};
+  // Stable addresses, nodes point to them.
+  deque<string, TrackingAllocator<string, MemoryKind::Ast>> names{};
+  // Source bytes parsed again into the storage by incremental re-parses, see reparse().
+  size_t reparsedSize{0};
+};
+
 struct Node {
   virtual void execute(VM *vm) = 0;
-  virtual ~Node() {
+  // Calls `fn` with every direct child node (statements, expressions and function bodies).
+  virtual void eachChild(function<void(Node const &)> const &fn) const {
+  }
+  // True if the node uses the absolute turtle state or world, see isStartInvariant().
+  virtual bool usesAbsoluteState() const {
+    return false;
+  }
+  virtual FnCallNode const *asFnCall() const {
+    return nullptr;
+  }
+  virtual FnDefNode const *asFnDef() const {
+    return nullptr;
+  }
+  // The variable the node reads (assignments have it as a child).
+  virtual string const *variableName() const {
+    return nullptr;
   }
 };
 
+using NodeList = ArenaList<Node *>;
+
+// True if the drawing of `node` only depends on the start position and angle through relative turtle moves: starting
+// elsewhere gives the same drawing rigidly transformed (see VM::transformFromStart).
+bool isStartInvariant(Node const &node) {
+  if (node.usesAbsoluteState()) return false;
+
+  bool isInvariant{true};
+  node.eachChild([&](Node const &child) { isInvariant = isInvariant && isStartInvariant(child); });
+  return isInvariant;
+}
+
+// True if `node` is or contains a function definition, in blocks and function bodies too.
+bool definesFunction(Node const &node) {
+  if (node.asFnDef() != nullptr) return true;
+
+  bool isDefining{false};
+  node.eachChild([&](Node const &child) { isDefining = isDefining || definesFunction(child); });
+  return isDefining;
+}
+
+// True if `node` reads or assigns a variable not in `accessed` outside of function definitions, adding them to it.
+// Tells top-level statements that may first access a root variable apart without executing them.
+bool accessesNewVariable(Node const &node, unordered_set<string_view> &accessed) {
+  if (node.asFnDef() != nullptr) return false;
+
+  bool isNew = node.variableName() != nullptr && accessed.insert(*node.variableName()).second;
+  node.eachChild([&](Node const &child) { isNew = accessesNewVariable(child, accessed) || isNew; });
+  return isNew;
+}
+
 struct Program : Node {
-  vector<unique_ptr<Node>> statements;
+  // Shared with the VM functions defined by the program, they point into it.
+  shared_ptr<AstStorage> storage;
+  NodeList statements;
+  // Source offset of every top-level statement, a statement's text runs until the next one starts (see
+  // statementText()).
+  vector<size_t> statementStarts;
+  // Source line every top-level statement starts on, in the storage: the lines of its calls are relative to it.
+  vector<uint32_t *> statementLines;
+  size_t sourceSize;
 
-  Program(vector<unique_ptr<Node>> statements) : statements(std::move(statements)) {
+  Program(shared_ptr<AstStorage> storage, NodeList statements, vector<size_t> statementStarts,
+          vector<uint32_t *> statementLines, size_t sourceSize)
+      : storage(std::move(storage)),
+        statements(statements),
+        statementStarts(std::move(statementStarts)),
+        statementLines(std::move(statementLines)),
+        sourceSize(sourceSize) {
+  }
+
+  // With the whitespace and comments up to the next statement.
+  string_view statementText(string_view source, size_t i) const {
+    size_t end = i + 1 < statementStarts.size() ? statementStarts[i + 1] : sourceSize;
+    return source.substr(statementStarts[i], end - statementStarts[i]);
+  }
+
+  void eachChild(function<void(Node const &)> const &fn) const {
+    for (Node const *stmt : statements) fn(*stmt);
   }
 
   void execute(VM *vm) {
-    for (auto &stmt : statements) {
+    vm->runningProgram = storage;
+    vm->runHistoryStart = vm->history.size();
+    // Left over by a run that ended in an error.
+    vm->shadowStack.clear();
+    for (Node *stmt : statements) {
+      vm->executedStatements++;
       stmt->execute(vm);
     }
   }
 
-  ~Program() {
+  // Executes the top-level statements from `first` on while recording checkpoints and the root variable accesses (see
+  // VM::checkpoints). Checkpoints are taken before `first`, before the statements that may access a root variable
+  // first and every VM::CHECKPOINT_INTERVAL statements in between. The VM has to be in the state of the checkpoint
+  // before `first`.
+  void executeFrom(VM *vm, size_t first) {
+    vm->runningProgram = storage;
+    vm->runHistoryStart = vm->history.size();
+    vm->shadowStack.clear();
+    erase_if(vm->checkpoints, [&](Checkpoint const &checkpoint) { return checkpoint.statement >= first; });
+    erase_if(vm->firstRootAccess, [&](auto const &access) { return access.second >= first; });
+    vm->isCheckpointing = true;
+    vm->isCheckpointComplete = false;
+
+    // Views the names in the program and the keys of VM::firstRootAccess, both outlive the run.
+    unordered_set<string_view> accessed{};
+    for (auto const &[name, statement] : vm->firstRootAccess) accessed.insert(name);
+
+    try {
+      for (size_t i = first; i < statements.size(); i++) {
+        bool isNewAccess = accessesNewVariable(*statements[i], accessed);
+        if (i == first || isNewAccess || i - vm->checkpoints.back().statement >= VM::CHECKPOINT_INTERVAL) {
+          vm->saveCheckpoint(i);
+        }
+        vm->currentStatement = i;
+        vm->executedStatements++;
+        statements[i]->execute(vm);
+      }
+    } catch (...) {
+      vm->isCheckpointing = false;
+      throw;
+    }
+
+    vm->isCheckpointing = false;
+    vm->isCheckpointComplete = true;
+    vm->checkpointedStatementCount = statements.size();
   }
 };
 
 struct Expr : Node {
-  virtual Value value() const = 0;
-  virtual ~Expr() = default;
+  virtual Value eval(VM *vm) = 0;
+
+  void execute(VM *vm) {
+    eval(vm);
+  }
 };
 
+using ExprList = ArenaList<Expr *>;
+
 struct FloatExpr : Expr {
-  Value floatValue;
+  float floatValue;
 
   FloatExpr(float v) : floatValue(v) {
   }
 
-  void execute(VM *vm) {
-  }
-
-  Value value() const {
-    return floatValue;
-  }
-
-  ~FloatExpr() {
+  Value eval(VM *vm) {
+    return Value(floatValue);
   }
 };
 
 struct NameExpr : Expr {
-  Value v;
-  string name;
+  string const *name;
 
-  NameExpr(string name) : name(name) {
+  NameExpr(string const *name) : name(name) {
   }
 
-  void execute(VM *vm) {
-    v = vm->frames.back().variables[name];
+  string const *variableName() const {
+    return name;
   }
 
-  Value value() const {
-    return v;
-  }
-
-  ~NameExpr() {
+  Value eval(VM *vm) {
+    vm->noteRootAccess(*name);
+    return vm->frames.back().variable(*name);
   }
 };
 
 struct StringExpr : Expr {
-  Value stringValue;
-
-  StringExpr(string s) : stringValue(s) {
-  }
+  string const *stringValue;
 
-  void execute(VM *vm) {
+  StringExpr(string const *s) : stringValue(s) {
   }
 
-  Value value() const {
-    return stringValue;
-  }
-
-  ~StringExpr() {
+  Value eval(VM *vm) {
+    return Value(*stringValue);
   }
 };
 
-enum BinOp {
-  Add,
-  Sub,
-  Div,
-  Mul,
-  Mod,
-  Lt,
-  Gt,
-  Lte,
-  Gte,
-  Eq,
-};
+using BinOp = OpKind;
 
 struct BinOpExpr : Expr {
   BinOp op;
-  unique_ptr<Expr> lhs;
-  unique_ptr<Expr> rhs;
-  Value v;
-
-  BinOpExpr(string opRaw, unique_ptr<Expr> lhs, unique_ptr<Expr> rhs) : lhs(std::move(lhs)), rhs(std::move(rhs)) {
-    if (opRaw == "+") {
-      op = BinOp::Add;
-    } else if (opRaw == "-") {
-      op = BinOp::Sub;
-    } else if (opRaw == "/") {
-      op = BinOp::Div;
-    } else if (opRaw == "*") {
-      op = BinOp::Mul;
-    } else if (opRaw == "%") {
-      op = BinOp::Mod;
-    } else if (opRaw == "<") {
-      op = BinOp::Lt;
-    } else if (opRaw == ">") {
-      op = BinOp::Gt;
-    } else if (opRaw == "<=") {
-      op = BinOp::Lte;
-    } else if (opRaw == ">=") {
-      op = BinOp::Gte;
-    } else if (opRaw == "==") {
-      op = BinOp::Eq;
-    } else {
-      THROW("Unknown op: %s", opRaw.c_str());
-    }
+  Expr *lhs;
+  Expr *rhs;
+
+  BinOpExpr(BinOp op, Expr *lhs, Expr *rhs) : op(op), lhs(lhs), rhs(rhs) {
   }
 
-  ~BinOpExpr() {
+  void eachChild(function<void(Node const &)> const &fn) const {
+    fn(*lhs);
+    fn(*rhs);
   }
 
-  void execute(VM *vm) {
-    lhs->execute(vm);
-    rhs->execute(vm);
-    Value lhsVal = lhs->value();
-    Value rhsVal = rhs->value();
+  Value eval(VM *vm) {
+    Value lhsVal = lhs->eval(vm);
+    Value rhsVal = rhs->eval(vm);
 
     switch (op) {
       case BinOp::Add:
-        v = lhsVal.add(rhsVal);
-        break;
+        return lhsVal.add(rhsVal);
       case BinOp::Sub:
-        v = lhsVal.sub(rhsVal);
-        break;
+        return lhsVal.sub(rhsVal);
       case BinOp::Div:
-        v = lhsVal.div(rhsVal);
-        break;
+        return lhsVal.div(rhsVal);
       case BinOp::Mul:
-        v = lhsVal.mul(rhsVal);
-        break;
+        return lhsVal.mul(rhsVal);
       case BinOp::Mod:
-        v = lhsVal.mod(rhsVal);
-        break;
+        return lhsVal.mod(rhsVal);
       case BinOp::Lt:
-        v = lhsVal.lt(rhsVal);
-        break;
+        return lhsVal.lt(rhsVal);
       case BinOp::Gt:
-        v = rhsVal.lt(lhsVal);
-        break;
+        return rhsVal.lt(lhsVal);
       case BinOp::Lte:
-        v = lhsVal.lte(rhsVal);
-        break;
+        return lhsVal.lte(rhsVal);
       case BinOp::Gte:
-        v = rhsVal.lte(lhsVal);
-        break;
+        return rhsVal.lte(lhsVal);
       case BinOp::Eq:
-        v = lhsVal.eq(rhsVal);
-        break;
+        return lhsVal.eq(rhsVal);
       default:
         THROW("Unreachable");
+        return Value{};
     }
   }
-
-  Value value() const {
-    return v;
-  }
 };
 
 struct AssignmentNode : Node {
-  unique_ptr<NameExpr> lval;
-  unique_ptr<Expr> rval;
+  NameExpr *lval;
+  Expr *rval;
 
-  AssignmentNode(unique_ptr<NameExpr> lval, unique_ptr<Expr> rval) : lval(std::move(lval)), rval(std::move(rval)) {
+  AssignmentNode(NameExpr *lval, Expr *rval) : lval(lval), rval(rval) {
   }
 
-  ~AssignmentNode() {
+  void eachChild(function<void(Node const &)> const &fn) const {
+    fn(*lval);
+    fn(*rval);
   }
 
   void execute(VM *vm) {
-    rval->execute(vm);
-    vm->frames.back().variables[lval->name] = rval->value();
+    Value value = rval->eval(vm);
+    vm->noteRootAccess(*lval->name);
+    vm->frames.back().variable(*lval->name) = value;
   }
 };
 
 struct LoopNode : Node {
-  unique_ptr<Expr> count;
-  vector<unique_ptr<Node>> statements;
+  Expr *count;
+  NodeList statements;
 
-  LoopNode(unique_ptr<Expr> count, vector<unique_ptr<Node>> statements)
-      : count(std::move(count)), statements(std::move(statements)) {
+  LoopNode(Expr *count, NodeList statements) : count(count), statements(statements) {
   }
 
-  ~LoopNode() {
+  void eachChild(function<void(Node const &)> const &fn) const {
+    fn(*count);
+    for (Node const *statement : statements) fn(*statement);
   }
 
   void execute(VM *vm) {
@@ -238,17 +311,18 @@ struct LoopNode : Node {
     snprintf(loopVarNameBuf, 8, "_i%d", vm->frames.back().loopCount++);
     string loopVarName{loopVarNameBuf};
 
-    count->execute(vm);
+    Value countValue = count->eval(vm);
 
-    if (count->value().kind != ValueKind::Number) {
+    if (countValue.kind != ValueKind::Number) {
       THROW("Only number can be a loop count");
     }
 
-    unsigned int iter = (unsigned int)count->value().floatVal;
+    unsigned int iter = (unsigned int)countValue.floatVal;
     for (unsigned int i = 0; i < iter; i++) {
-      vm->frames.back().variables[loopVarName] = Value((float)i);
+      vm->frames.back().variable(loopVarName) = Value((float)i);
 
-      for (auto &statement : statements) {
+      for (Node *statement : statements) {
+        vm->executedStatements++;
         statement->execute(vm);
       }
     }
@@ -258,65 +332,70 @@ struct LoopNode : Node {
 };
 
 struct IfNode : Node {
-  unique_ptr<Expr> condNode;
-  vector<unique_ptr<Node>> trueStatements;
-  vector<unique_ptr<Node>> falseStatements;
+  Expr *condNode;
+  NodeList trueStatements;
+  NodeList falseStatements;
 
-  IfNode(unique_ptr<Expr> condNode, vector<unique_ptr<Node>> trueStatements, vector<unique_ptr<Node>> falseStatements)
-      : condNode(std::move(condNode)),
-        trueStatements(std::move(trueStatements)),
-        falseStatements(std::move(falseStatements)) {
+  IfNode(Expr *condNode, NodeList trueStatements, NodeList falseStatements)
+      : condNode(condNode), trueStatements(trueStatements), falseStatements(falseStatements) {
   }
 
-  ~IfNode() {
+  void eachChild(function<void(Node const &)> const &fn) const {
+    fn(*condNode);
+    for (Node const *statement : trueStatements) fn(*statement);
+    for (Node const *statement : falseStatements) fn(*statement);
   }
 
   void execute(VM *vm) {
-    condNode->execute(vm);
-    assert_or_throw(condNode->value().kind == ValueKind::Boolean, "Not bool for IF condition");
+    Value cond = condNode->eval(vm);
+    assert_or_throw(cond.kind == ValueKind::Boolean, "Not bool for IF condition");
 
-    if (condNode->value().boolVal) {
-      for (auto &statement : trueStatements) {
-        statement->execute(vm);
-      }
-    } else {
-      for (auto &statement : falseStatements) {
-        statement->execute(vm);
-      }
+    for (Node *statement : cond.boolVal ? trueStatements : falseStatements) {
+      vm->executedStatements++;
+      statement->execute(vm);
     }
   }
 };
 
 struct ExecutableFnNode : Node {
-  vector<string> argNames;
-  vector<unique_ptr<Node>> statements;
+  ArenaList<string const *> argNames;
+  NodeList statements;
 
-  ExecutableFnNode(vector<string> argNames, vector<unique_ptr<Node>> statements)
-      : argNames(argNames), statements(std::move(statements)) {
+  ExecutableFnNode(ArenaList<string const *> argNames, NodeList statements)
+      : argNames(argNames), statements(statements) {
   }
 
-  ~ExecutableFnNode() {
+  void eachChild(function<void(Node const &)> const &fn) const {
+    for (Node const *statement : statements) fn(*statement);
   }
 
   void execute(VM *vm) {
-    for (auto &statement : statements) {
+    for (Node *statement : statements) {
+      vm->executedStatements++;
       statement->execute(vm);
     }
   }
 };
 
 struct FnDefNode : Node {
-  string name;
-  shared_ptr<ExecutableFnNode> fn;
+  string const *name;
+  ExecutableFnNode *fn;
 
-  FnDefNode(string name, vector<string> argNames, vector<unique_ptr<Node>> statements) : name(name) {
-    fn = make_shared<ExecutableFnNode>(std::move(argNames), std::move(statements));
+  FnDefNode(string const *name, ExecutableFnNode *fn) : name(name), fn(fn) {
   }
-  ~FnDefNode() {
+
+  void eachChild(function<void(Node const &)> const &fn) const {
+    fn(*this->fn);
+  }
+
+  FnDefNode const *asFnDef() const {
+    return this;
   }
 
   void execute(VM *vm) {
-    vm->functions[name] = fn;
+    // Keeps the program alive while the function is defined.
+    vm->functions[*name] = shared_ptr<ExecutableFnNode>(vm->runningProgram, fn);
+    vm->definitionsVersion++;
   }
 };
 
@@ -348,92 +427,131 @@ enum FnName {
   FN_UNKNOWN,
 };
 
+// Canonical builtin names by FnName, for the profiler.
+constexpr const char *FN_NAMES[] = {
+    "forward", "backward", "left", "right", "up", "down", "pos", "angle", "thickness", "rand", "clear", "intvar",
+    "floatvar", "getx", "gety", "winw", "winh", "midx", "midy", "getangle", "debug", "push", "pop", "line",
+};
+static_assert(size(FN_NAMES) == FN_UNKNOWN && FN_UNKNOWN <= Profiler::MAX_BUILTINS);
+
 struct FnCallNode : Expr {
-  Value v{};
   FnName knownFnName;
-  string fnNameOriginal;
-  vector<unique_ptr<Expr>> args;
-
-  FnCallNode(string fnNameOriginal, vector<unique_ptr<Expr>> args)
-      : fnNameOriginal(fnNameOriginal), args(std::move(args)) {
-    if (fnNameOriginal == "forward" || fnNameOriginal == "f") {
+  string const *fnNameOriginal;
+  ExprList args;
+  // Source line of the call, for the sampling profiler: relative to the first line of its top-level statement, which
+  // reparse() updates when the statement moves (see sourceLine()).
+  uint32_t const *statementLine;
+  uint32_t line;
+
+  FnCallNode(string const *fnNameOriginal, ExprList args, uint32_t const *statementLine, uint32_t line)
+      : fnNameOriginal(fnNameOriginal), args(args), statementLine(statementLine), line(line) {
+    if (*fnNameOriginal == "forward" || *fnNameOriginal == "f") {
       knownFnName = FnName::FN_FORWARD;
-    } else if (fnNameOriginal == "backward" || fnNameOriginal == "b") {
+    } else if (*fnNameOriginal == "backward" || *fnNameOriginal == "b") {
       knownFnName = FnName::FN_BACKWARD;
-    } else if (fnNameOriginal == "left" || fnNameOriginal == "l") {
+    } else if (*fnNameOriginal == "left" || *fnNameOriginal == "l") {
       knownFnName = FnName::FN_LEFT;
-    } else if (fnNameOriginal == "right" || fnNameOriginal == "r") {
+    } else if (*fnNameOriginal == "right" || *fnNameOriginal == "r") {
       knownFnName = FnName::FN_RIGHT;
-    } else if (fnNameOriginal == "up" || fnNameOriginal == "u") {
+    } else if (*fnNameOriginal == "up" || *fnNameOriginal == "u") {
       knownFnName = FnName::FN_UP;
-    } else if (fnNameOriginal == "down" || fnNameOriginal == "d") {
+    } else if (*fnNameOriginal == "down" || *fnNameOriginal == "d") {
       knownFnName = FnName::FN_DOWN;
-    } else if (fnNameOriginal == "pos" || fnNameOriginal == "p") {
+    } else if (*fnNameOriginal == "pos" || *fnNameOriginal == "p") {
       knownFnName = FnName::FN_POS;
-    } else if (fnNameOriginal == "angle" || fnNameOriginal == "a") {
+    } else if (*fnNameOriginal == "angle" || *fnNameOriginal == "a") {
       knownFnName = FnName::FN_ANGLE;
-    } else if (fnNameOriginal == "thickness" || fnNameOriginal == "t") {
+    } else if (*fnNameOriginal == "thickness" || *fnNameOriginal == "t") {
       knownFnName = FnName::FN_THICKNESS;
-    } else if (fnNameOriginal == "rand") {
+    } else if (*fnNameOriginal == "rand") {
       knownFnName = FnName::FN_RAND;
-    } else if (fnNameOriginal == "clear" || fnNameOriginal == "c") {
+    } else if (*fnNameOriginal == "clear" || *fnNameOriginal == "c") {
       knownFnName = FnName::FN_CLEAR;
-    } else if (fnNameOriginal == "intvar") {
+    } else if (*fnNameOriginal == "intvar") {
       knownFnName = FnName::FN_INTVAR;
-    } else if (fnNameOriginal == "floatvar") {
+    } else if (*fnNameOriginal == "floatvar") {
       knownFnName = FnName::FN_FLOATVAR;
-    } else if (fnNameOriginal == "getx") {
+    } else if (*fnNameOriginal == "getx") {
       knownFnName = FnName::FN_GETX;
-    } else if (fnNameOriginal == "gety") {
+    } else if (*fnNameOriginal == "gety") {
       knownFnName = FnName::FN_GETY;
-    } else if (fnNameOriginal == "winw") {
+    } else if (*fnNameOriginal == "winw") {
       knownFnName = FnName::FN_WINW;
-    } else if (fnNameOriginal == "winh") {
+    } else if (*fnNameOriginal == "winh") {
       knownFnName = FnName::FN_WINH;
-    } else if (fnNameOriginal == "midx") {
+    } else if (*fnNameOriginal == "midx") {
       knownFnName = FnName::FN_MIDX;
-    } else if (fnNameOriginal == "midy") {
+    } else if (*fnNameOriginal == "midy") {
       knownFnName = FnName::FN_MIDY;
-    } else if (fnNameOriginal == "getangle") {
+    } else if (*fnNameOriginal == "getangle") {
       knownFnName = FnName::FN_GETANGLE;
-    } else if (fnNameOriginal == "debug") {
+    } else if (*fnNameOriginal == "debug") {
       knownFnName = FnName::FN_DEBUG;
-    } else if (fnNameOriginal == "push") {
+    } else if (*fnNameOriginal == "push") {
       knownFnName = FnName::FN_PUSH;
-    } else if (fnNameOriginal == "pop") {
+    } else if (*fnNameOriginal == "pop") {
       knownFnName = FnName::FN_POP;
-    } else if (fnNameOriginal == "line") {
+    } else if (*fnNameOriginal == "line") {
       knownFnName = FnName::FN_LINE;
     } else {
       knownFnName = FnName::FN_UNKNOWN;
     }
   }
 
-  void execute(VM *vm) {
-    for (auto &arg : args) arg->execute(vm);
+  Value eval(VM *vm) {
+    // The argument values go on the VM's stack of them, the nested calls evaluated meanwhile leave it as they found it.
+    size_t argBase = vm->argValues.size();
+    for (Expr *arg : args) {
+      Value argValue = arg->eval(vm);
+      vm->argValues.push_back(std::move(argValue));
+    }
+    Value const *argv = vm->argValues.data() + argBase;
+
+    if (sampler.isSampleDue.load(memory_order_relaxed)) [[unlikely]] {
+      sampler.sample(vm->shadowStack, ShadowFrame{fnNameOriginal, sourceLine()});
+    }
 
+    Value result{};
+    if (vm->profiler.isEnabled) [[unlikely]] {
+      ProfileStats &stats = knownFnName == FnName::FN_UNKNOWN
+                                ? vm->profiler.function(*fnNameOriginal)
+                                : vm->profiler.builtin(knownFnName, FN_NAMES[knownFnName]);
+      vm->profiler.enter(stats, vm->history.size());
+      result = call(vm, argv);
+      vm->profiler.leave(vm->history.size());
+    } else {
+      result = call(vm, argv);
+    }
+
+    vm->argValues.resize(argBase);
+    return result;
+  }
+
+  // The call itself with the evaluated arguments, they are only valid until the call evaluates anything.
+  Value call(VM *vm, Value const *argv) {
+    Value result{};
     string name;
 
     switch (knownFnName) {
       case FnName::FN_FORWARD:
         assert_or_throw(args.size() == 1, "Expected 1 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::Number, "FORWARD expects a number arg");
-        vm->forward(args[0]->value().floatVal);
+        assert_or_throw(argv[0].kind == ValueKind::Number, "FORWARD expects a number arg");
+        vm->forward(argv[0].floatVal);
         break;
       case FnName::FN_BACKWARD:
         assert_or_throw(args.size() == 1, "Expected 1 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::Number, "BACKWARD expects a number arg");
-        vm->backward(args[0]->value().floatVal);
+        assert_or_throw(argv[0].kind == ValueKind::Number, "BACKWARD expects a number arg");
+        vm->backward(argv[0].floatVal);
         break;
       case FnName::FN_LEFT:
         assert_or_throw(args.size() == 1, "Expected 1 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::Number, "LEFT expects a number arg");
-        vm->left(args[0]->value().floatVal);
+        assert_or_throw(argv[0].kind == ValueKind::Number, "LEFT expects a number arg");
+        vm->left(argv[0].floatVal);
         break;
       case FnName::FN_RIGHT:
         assert_or_throw(args.size() == 1, "Expected 1 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::Number, "RIGHT expects a number arg");
-        vm->right(args[0]->value().floatVal);
+        assert_or_throw(argv[0].kind == ValueKind::Number, "RIGHT expects a number arg");
+        vm->right(argv[0].floatVal);
         break;
       case FnName::FN_UP:
         assert_or_throw(args.size() == 0, "Expected 0 args");
@@ -445,140 +563,373 @@ struct FnCallNode : Expr {
         break;
       case FnName::FN_POS:
         assert_or_throw(args.size() == 2, "Expected 2 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::Number, "POS expects number args");
-        assert_or_throw(args[1]->value().kind == ValueKind::Number, "POS expects number args");
-        vm->setPos(args[0]->value().floatVal, args[1]->value().floatVal);
+        assert_or_throw(argv[0].kind == ValueKind::Number, "POS expects number args");
+        assert_or_throw(argv[1].kind == ValueKind::Number, "POS expects number args");
+        vm->setPos(argv[0].floatVal, argv[1].floatVal);
         break;
       case FnName::FN_ANGLE:
         assert_or_throw(args.size() == 1, "Expected 1 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::Number, "POS expects number args");
-        vm->angle = args[0]->value().floatVal;
+        assert_or_throw(argv[0].kind == ValueKind::Number, "POS expects number args");
+        vm->angle = argv[0].floatVal;
         break;
       case FnName::FN_THICKNESS:
         assert_or_throw(args.size() == 1, "Expected 1 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::Number, "THICKNESS expects a number arg");
-        vm->thickness = args[0]->value().floatVal;
+        assert_or_throw(argv[0].kind == ValueKind::Number, "THICKNESS expects a number arg");
+        vm->thickness = argv[0].floatVal;
         break;
       case FnName::FN_RAND:
         assert_or_throw(args.size() == 2, "Expected 2 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::Number, "RAND expects a number arg");
-        assert_or_throw(args[0]->value().kind == ValueKind::Number, "RAND expects a number arg");
-        v = Value(randf((int)args[0]->value().floatVal, (int)args[1]->value().floatVal));
+        assert_or_throw(argv[0].kind == ValueKind::Number, "RAND expects a number arg");
+        assert_or_throw(argv[0].kind == ValueKind::Number, "RAND expects a number arg");
+        result = Value(randf((int)argv[0].floatVal, (int)argv[1].floatVal));
         break;
       case FnName::FN_CLEAR:
         vm->reset();
         break;
       case FnName::FN_INTVAR:
         assert_or_throw(args.size() == 4, "Expected 4 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::String, "intvar expects a string arg");
-        assert_or_throw(args[1]->value().kind == ValueKind::Number, "intvar expects a number arg");
-        assert_or_throw(args[2]->value().kind == ValueKind::Number, "intvar expects a number arg");
-        assert_or_throw(args[3]->value().kind == ValueKind::Number, "intvar expects a number arg");
+        assert_or_throw(argv[0].kind == ValueKind::String, "intvar expects a string arg");
+        assert_or_throw(argv[1].kind == ValueKind::Number, "intvar expects a number arg");
+        assert_or_throw(argv[2].kind == ValueKind::Number, "intvar expects a number arg");
+        assert_or_throw(argv[3].kind == ValueKind::Number, "intvar expects a number arg");
         // TODO: This is horrible. Logo and VM is in a circular dep so we cannot
         // fully put Logo structs (non ref / non pointer) into VM.
-        name = args[0]->value().strVal;
-        vm->intVars[name] = IntVar{(int)args[1]->value().floatVal, (int)args[2]->value().floatVal};
-        if (!vm->frames.front().variables.contains(name)) {
-          vm->frames.front().variables[name] = args[3]->value();
+        name = argv[0].strVal;
+        vm->intVars[name] = IntVar{(int)argv[1].floatVal, (int)argv[2].floatVal};
+        vm->definitionsVersion++;
+        if (!vm->frames.front().hasVariable(name)) {
+          vm->frames.front().variable(name) = argv[3];
         }
         break;
       case FnName::FN_FLOATVAR:
         assert_or_throw(args.size() == 4, "Expected 4 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::String, "intvar expects a string arg");
-        assert_or_throw(args[1]->value().kind == ValueKind::Number, "intvar expects a number arg");
-        assert_or_throw(args[2]->value().kind == ValueKind::Number, "intvar expects a number arg");
-        assert_or_throw(args[3]->value().kind == ValueKind::Number, "intvar expects a number arg");
+        assert_or_throw(argv[0].kind == ValueKind::String, "intvar expects a string arg");
+        assert_or_throw(argv[1].kind == ValueKind::Number, "intvar expects a number arg");
+        assert_or_throw(argv[2].kind == ValueKind::Number, "intvar expects a number arg");
+        assert_or_throw(argv[3].kind == ValueKind::Number, "intvar expects a number arg");
         // TODO: This is horrible. Logo and VM is in a circular dep so we cannot
         // fully put Logo structs (non ref / non pointer) into VM.
-        name = args[0]->value().strVal;
-        vm->floatVars[name] = FloatVar{args[1]->value().floatVal, args[2]->value().floatVal};
-        if (!vm->frames.front().variables.contains(name)) {
-          vm->frames.front().variables[name] = args[3]->value();
+        name = argv[0].strVal;
+        vm->floatVars[name] = FloatVar{argv[1].floatVal, argv[2].floatVal};
+        vm->definitionsVersion++;
+        if (!vm->frames.front().hasVariable(name)) {
+          vm->frames.front().variable(name) = argv[3];
         }
         break;
       case FnName::FN_GETX:
         assert_or_throw(args.size() == 0, "Expected 0 args");
-        v = Value(vm->pos.x);
+        result = Value(vm->pos.x);
         break;
       case FnName::FN_GETY:
         assert_or_throw(args.size() == 0, "Expected 0 args");
-        v = Value(vm->pos.y);
+        result = Value(vm->pos.y);
         break;
       case FnName::FN_WINW:
         assert_or_throw(args.size() == 0, "Expected 0 args");
-        v = Value((float)(GetScreenWidth()));
+        result = Value(vm->worldSize.x);
         break;
       case FnName::FN_WINH:
         assert_or_throw(args.size() == 0, "Expected 0 args");
-        v = Value((float)(GetScreenHeight()));
+        result = Value(vm->worldSize.y);
         break;
       case FnName::FN_MIDX:
         assert_or_throw(args.size() == 0, "Expected 0 args");
-        v = Value((float)(GetScreenWidth() >> 1));
+        result = Value((float)((int)vm->worldSize.x >> 1));
         break;
       case FnName::FN_MIDY:
         assert_or_throw(args.size() == 0, "Expected 0 args");
-        v = Value((float)(GetScreenHeight() >> 1));
+        result = Value((float)((int)vm->worldSize.y >> 1));
         break;
       case FnName::FN_GETANGLE:
         assert_or_throw(args.size() == 0, "Expected 0 args");
-        v = Value(vm->angle);
+        result = Value(vm->angle);
         break;
       case FnName::FN_DEBUG:
-        for (auto &arg : args) {
-          arg->execute(vm);
-          arg->value().debug();
-        }
+        for (size_t i = 0; i < args.size(); i++) argv[i].debug();
         break;
       case FnName::FN_PUSH:
-        for (auto &arg : args) {
-          vm->stack.push_back(arg->value());
-        }
+        for (size_t i = 0; i < args.size(); i++) vm->stack.push_back(argv[i]);
         break;
       case FnName::FN_POP:
         assert_or_throw(args.size() == 0, "Expected 0 args");
         assert_or_throw(!vm->stack.empty(), "Empty stack on pop");
 
-        v = vm->stack.back();
+        result = vm->stack.back();
         vm->stack.pop_back();
         break;
       case FnName::FN_LINE:
         assert_or_throw(args.size() == 4, "Expected 4 args");
-        assert_or_throw(args[0]->value().kind == ValueKind::Number, "intvar expects a number arg");
-        assert_or_throw(args[1]->value().kind == ValueKind::Number, "intvar expects a number arg");
-        assert_or_throw(args[2]->value().kind == ValueKind::Number, "intvar expects a number arg");
-        assert_or_throw(args[3]->value().kind == ValueKind::Number, "intvar expects a number arg");
-        vm->history.emplace_back(Vector2{args[0]->value().floatVal, args[1]->value().floatVal},
-                                 Vector2{args[2]->value().floatVal, args[3]->value().floatVal}, vm->thickness,
+        assert_or_throw(argv[0].kind == ValueKind::Number, "intvar expects a number arg");
+        assert_or_throw(argv[1].kind == ValueKind::Number, "intvar expects a number arg");
+        assert_or_throw(argv[2].kind == ValueKind::Number, "intvar expects a number arg");
+        assert_or_throw(argv[3].kind == ValueKind::Number, "intvar expects a number arg");
+        vm->spendLine();
+        vm->history.emplace_back(Vector2{argv[0].floatVal, argv[1].floatVal},
+                                 Vector2{argv[2].floatVal, argv[3].floatVal}, vm->thickness,
                                  vm->color);
+        if (vm->culling.isLearning()) {
+          vm->culling.extent.addLine(vm->history.back().from, vm->history.back().to, vm->thickness);
+        }
         break;
       default:
-        if (!vm->functions.contains(fnNameOriginal)) {
-          THROW("Unrecognized function name: %s", fnNameOriginal.c_str());
+        ExecutableFnNode *fn = vm->function(*fnNameOriginal);
+        if (fn == nullptr) {
+          THROW("Unrecognized function name: %s", fnNameOriginal->c_str());
         }
 
-        auto fn = vm->functions[fnNameOriginal];
-
         assert_or_throw(args.size() == fn->argNames.size(), "FN arg count mismatch");
 
-        Frame newFrame{};
+        LearnedFunction *learned = vm->culling.isLearning() ? &learnedFunction(vm, fn) : nullptr;
+        optional<CallKey> cullKey =
+            learned != nullptr && learned->safety != CallSafety::Unsafe ? callKey(vm, fn, argv) : nullopt;
+        if (cullKey.has_value() &&
+            (skipCall(vm, cullKey.value(), *learned) || pruneCall(vm, cullKey.value(), *learned))) {
+          break;
+        }
+
+        Vector2 startPos{vm->pos};
+        float startAngle{vm->angle};
+        float outerMaxForward{vm->culling.maxForward};
+        CallExtent outerExtent{vm->culling.extent};
+        vm->culling.maxForward = 0.f;
+        vm->culling.extent = CallExtent{startPos};
 
+        Frame &newFrame = vm->pushFrame();
         for (int i = 0; i < (int)args.size(); i++) {
-          newFrame.variables[fn->argNames[i]] = args[i]->value();
+          newFrame.variable(*fn->argNames[i]) = argv[i];
         }
 
-        vm->frames.push_back(newFrame);
+        vm->shadowStack.push_back(ShadowFrame{fnNameOriginal, sourceLine()});
         fn->execute(vm);
-        vm->frames.pop_back();
+        vm->shadowStack.pop_back();
+        vm->popFrame();
+
+        float radius = vm->culling.extent.radius();
+        if (cullKey.has_value()) learnCall(vm, cullKey.value(), *learned, startPos, startAngle, radius);
+        vm->culling.maxForward = max(outerMaxForward, vm->culling.maxForward);
+        vm->culling.extent = outerExtent;
+        if (vm->culling.isLearning()) vm->culling.extent.addCircle(startPos, radius);
         break;
     }
+
+    return result;
+  }
+
+  void eachChild(function<void(Node const &)> const &fn) const {
+    for (Expr const *arg : args) fn(*arg);
+  }
+
+  FnCallNode const *asFnCall() const {
+    return this;
+  }
+
+  uint32_t sourceLine() const {
+    return *statementLine + line;
+  }
+
+  // Builtins that place the turtle absolutely, read its absolute state or the world size. clear() moves the turtle
+  // back to the middle and rand() would give a different drawing on every run.
+  bool usesAbsoluteState() const {
+    switch (knownFnName) {
+      case FnName::FN_POS:
+      case FnName::FN_ANGLE:
+      case FnName::FN_LINE:
+      case FnName::FN_GETX:
+      case FnName::FN_GETY:
+      case FnName::FN_GETANGLE:
+      case FnName::FN_WINW:
+      case FnName::FN_WINH:
+      case FnName::FN_MIDX:
+      case FnName::FN_MIDY:
+      case FnName::FN_CLEAR:
+      case FnName::FN_RAND:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+ private:
+  optional<CallKey> callKey(VM *vm, ExecutableFnNode const *fn, Value const *argv) const;
+  static LearnedFunction &learnedFunction(VM *vm, ExecutableFnNode const *fn);
+
+  // Applies the learned effect of the call instead of executing it if its drawing is outside of the culling rect.
+  static bool skipCall(VM *vm, CallKey const &key, LearnedFunction const &learned) {
+    if (!vm->culling.isEnabled || learned.safety != CallSafety::Relative) return false;
+
+    CallEffect const *effect = vm->culling.trustedEffect(key);
+    if (effect == nullptr || !vm->culling.isOutside(vm->pos, effect->radius)) return false;
+
+    vm->culling.skippedCallCount++;
+    applyEffect(vm, *effect);
+    return true;
+  }
+
+  // Level of detail: a call whose drawing would stay within the threshold on screen is drawn as one line. Calls of
+  // functions that return to their start (branches, leaves) can be predicted by the size model: drawn from their
+  // start along the heading as far as the drawing reaches, they leave the turtle where it was. Calls of Relative
+  // functions can also be pruned by a trusted effect whose every move is shorter than the threshold (the size model
+  // is an upper bound, a call's own effect is tighter), drawn from their start to their end.
+  static bool pruneCall(VM *vm, CallKey const &key, LearnedFunction const &learned) {
+    if (!vm->culling.isLodEnabled) return false;
+    float maxRadius = vm->culling.lodThreshold / vm->culling.lodScale;
+
+    CallSizeModel const &model = learned.size;
+    optional<float> radius = model.returnsToStart ? model.predictRadius(key) : nullopt;
+    if (radius.has_value() && radius.value() < maxRadius) {
+      vm->culling.prunedCallCount++;
+      drawPruned(vm, radius.value());
+      if (!model.keepsThickness) {
+        // A thickness the calls did not end with consistently is left as it was.
+        optional<int> thicknessArg = model.thicknessArg(key.argCount);
+        if (thicknessArg.has_value()) vm->thickness = key.args[thicknessArg.value()];
+      }
+      return true;
+    }
+
+    if (learned.safety != CallSafety::Relative) return false;
+
+    CallEffect const *effect = vm->culling.trustedEffect(key);
+    if (effect == nullptr || effect->maxForward >= maxRadius || effect->radius >= maxRadius) return false;
+
+    Vector2 startPos{vm->pos};
+    float startRad{vm->rad()};
+    bool wasDown{vm->isDown};
+    float thickness{vm->thickness};
+
+    vm->culling.prunedCallCount++;
+    applyEffect(vm, *effect);
+
+    if (wasDown && effect->radius > 0.f) {
+      vm->spendLine();
+      Vector2 end{vm->pos};
+      if (hypotf(end.x - startPos.x, end.y - startPos.y) < effect->radius / 4.f) {
+        end = Vector2{startPos.x + sinf(startRad) * effect->radius, startPos.y - cosf(startRad) * effect->radius};
+      }
+      vm->history.emplace_back(startPos, end, thickness, vm->color);
+    }
+    return true;
   }
 
-  Value value() const {
-    return v;
+  // The line of a pruned call that returns to its start.
+  static void drawPruned(VM *vm, float radius) {
+    vm->culling.extent.addCircle(vm->pos, radius);
+    if (!vm->isDown || radius <= 0.f) return;
+
+    vm->spendLine();
+    Vector2 end{vm->pos.x + sinf(vm->rad()) * radius, vm->pos.y - cosf(vm->rad()) * radius};
+    vm->history.emplace_back(vm->pos, end, vm->thickness, vm->color);
   }
 
-  ~FnCallNode() {
+  static void applyEffect(VM *vm, CallEffect const &effect) {
+    vm->culling.extent.addCircle(vm->pos, effect.radius);
+    vm->culling.maxForward = max(vm->culling.maxForward, effect.maxForward);
+
+    float c = cosf(vm->rad());
+    float s = sinf(vm->rad());
+    vm->pos.x += c * effect.localMove.x - s * effect.localMove.y;
+    vm->pos.y += s * effect.localMove.x + c * effect.localMove.y;
+    vm->angle += effect.turn;
+    vm->normalizeAngle();
+    vm->isDown = effect.isDown;
+    vm->thickness = effect.thickness;
+  }
+
+  // Learns the size of an executed call for LOD and, for Relative functions, its effect.
+  static void learnCall(VM *vm, CallKey const &key, LearnedFunction &learned, Vector2 startPos, float startAngle,
+                        float radius) {
+    float dx = vm->pos.x - startPos.x;
+    float dy = vm->pos.y - startPos.y;
+    float turn = fmod(fmod(vm->angle - startAngle, 360) + 360.0f, 360);
+
+    if (vm->culling.isLodEnabled) {
+      float tolerance = CallCulling::EFFECT_EPSILON * max(1.f, radius);
+      bool didReturn = hypotf(dx, dy) <= tolerance && min(turn, 360.f - turn) <= 1e-3f && vm->isDown == key.isDown;
+      learned.size.learn(key, radius, didReturn, vm->thickness);
+    }
+
+    if (learned.safety != CallSafety::Relative) return;
+    // Calls with this key draw the same, too big to be pruned: only culling can use the effect.
+    float maxRadius = vm->culling.lodThreshold / vm->culling.lodScale;
+    if (!vm->culling.isEnabled && (radius >= maxRadius || vm->culling.maxForward >= maxRadius)) return;
+    if (vm->culling.trustedEffect(key) != nullptr) return;
+
+    // The move in the frame of the start angle.
+    float c = cosf(startAngle * DEG2RAD);
+    float s = sinf(startAngle * DEG2RAD);
+    Vector2 localMove{c * dx + s * dy, -s * dx + c * dy};
+
+    vm->culling.learn(key,
+                      CallEffect{localMove, turn, vm->isDown, vm->thickness, radius, vm->culling.maxForward, 1, true});
   }
 };
+
+// How far calls of `fn` (and the functions it calls) can be predicted. Relative if they only draw relative to the
+// turtle, depend on nothing but their arguments and the pen, and have no effect besides the turtle state and their
+// drawing. Contained if they read or set the absolute turtle state, the world size or use rand(), but still only change
+// the turtle and draw. The value stack, intvar / floatvar, clear(), defining functions or calling undefined ones are
+// unsafe.
+CallSafety callSafety(ExecutableFnNode const &fn, VM const *vm, unordered_set<ExecutableFnNode const *> &visited) {
+  if (!visited.insert(&fn).second) return CallSafety::Relative;
+
+  CallSafety safety{CallSafety::Relative};
+  function<void(Node const &)> check = [&](Node const &node) {
+    if (safety == CallSafety::Unsafe) return;
+    if (node.asFnDef() != nullptr) {
+      safety = CallSafety::Unsafe;
+      return;
+    }
+
+    if (FnCallNode const *call = node.asFnCall(); call != nullptr) {
+      switch (call->knownFnName) {
+        case FnName::FN_PUSH:
+        case FnName::FN_POP:
+        case FnName::FN_INTVAR:
+        case FnName::FN_FLOATVAR:
+        case FnName::FN_CLEAR:
+          safety = CallSafety::Unsafe;
+          return;
+        case FnName::FN_UNKNOWN: {
+          ExecutableFnNode *callee = vm->function(*call->fnNameOriginal);
+          if (callee == nullptr) {
+            safety = CallSafety::Unsafe;
+            return;
+          }
+          safety = min(safety, callSafety(*callee, vm, visited));
+          if (safety == CallSafety::Unsafe) return;
+          break;
+        }
+        default:
+          if (call->usesAbsoluteState()) safety = min(safety, CallSafety::Contained);
+          break;
+      }
+    }
+
+    node.eachChild(check);
+  };
+
+  fn.eachChild(check);
+  return safety;
+}
+
+LearnedFunction &FnCallNode::learnedFunction(VM *vm, ExecutableFnNode const *fn) {
+  auto [it, isNew] = vm->culling.functions.try_emplace(fn);
+  if (isNew) {
+    unordered_set<ExecutableFnNode const *> visited{};
+    it->second.safety = callSafety(*fn, vm, visited);
+  }
+  return it->second;
+}
+
+optional<CallKey> FnCallNode::callKey(VM *vm, ExecutableFnNode const *fn, Value const *argv) const {
+  if (args.size() > CallKey::MAX_ARGS) return nullopt;
+
+  CallKey key{fn, {}, (int)args.size(), vm->isDown, vm->thickness};
+  for (int i = 0; i < (int)args.size(); i++) {
+    if (argv[i].kind != ValueKind::Number) return nullopt;
+    key.args[i] = argv[i].floatVal;
+  }
+
+  return key;
+}
 }  // namespace Ast
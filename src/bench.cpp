@@ -0,0 +1,482 @@
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "alloc_stats.h"
+#include "ast.h"
+#include "lexer.h"
+#include "logo.h"
+#include "parser.h"
+#include "util.h"
+#include "vm.h"
+
+// Benchmarks the interpreter: every script of the examples directory and generated stress programs, with their
+// intvars swept over min / max, run through lex, parse and execute. Prints one TSV row per case and compares the rows
+// with a baseline file:
+//
+//   ./bench [--examples DIR] [--repeat N] [--budget LINES] [--filter TEXT] [--baseline FILE] [--save-baseline FILE]
+//     [--threshold PERCENT]
+//
+// Times are the fastest of the repeats. Runs stop at the line budget (`truncated` is 1 then). Peak RSS is the peak of
+// the case's runs, from the RSS it started with (memory the allocator kept from the cases before included).
+//
+//   ./bench --frontend [--max-size BYTES] [--repeat N]
+//
+// Measures the lexer and the parser alone on generated sources of 1 KB to 100 MB: one TSV row per phase and size with
+// MB/s, tokens/s and allocations. The parser pulls its lexemes, so `parse` is lexing and parsing together. `reparse`
+// is the incremental parse of the source after a one character edit in its middle (see reparse()).
+
+using namespace std;
+
+struct BenchCase {
+  string name;
+  string source;
+  // Presets, empty for the defaults.
+  vector<pair<string, int>> vars;
+};
+
+struct BenchResult {
+  float parseMs{};
+  float executeMs{};
+  uint64_t statements{};
+  size_t segments{};
+  bool isTruncated{};
+  AllocStats allocs{};
+  long peakRssKb{};
+
+  double nsPerStatement() const {
+    return statements == 0 ? 0.0 : executeMs * 1e6 / statements;
+  }
+
+  double segmentsPerSec() const {
+    return executeMs <= 0.f ? 0.0 : segments / (executeMs / 1000.0);
+  }
+};
+
+struct BenchOptions {
+  string examplesDir{"examples"};
+  int repeat{3};
+  size_t lineBudget{1'000'000};
+  string filter{};
+  string baselinePath{};
+  string saveBaselinePath{};
+  double threshold{10.0};
+  bool isFrontend{false};
+  size_t maxSourceSize{100 * 1024 * 1024};
+};
+
+// Generated programs stressing one part of the interpreter each.
+vector<BenchCase> stressCases() {
+  vector<BenchCase> cases{};
+
+  cases.push_back(BenchCase{"stress/deep_recursion",
+                            "fn descend(n) {\n  f(1)\n  r(1)\n  if (n > 0) {\n    descend(n - 1)\n  }\n}\n"
+                            "intvar(\"depth\", 100, 4000, 2000)\nintvar(\"rounds\", 1, 100, 20)\n"
+                            "loop (rounds) {\n  descend(depth)\n}\n",
+                            {}});
+
+  cases.push_back(BenchCase{"stress/long_loop",
+                            "intvar(\"count\", 1000, 1000000, 200000)\nloop (count) {\n  f(1)\n  r(0.5)\n}\n", {}});
+
+  cases.push_back(BenchCase{"stress/arithmetic",
+                            "intvar(\"count\", 1000, 1000000, 100000)\nx = 0\ny = 0\nloop (count) {\n"
+                            "  x = x + 1.5 * 2 - 3 / 4\n  y = x * x - x / 3 + (x - 1) * 2\n  y = y / (x + 1)\n}\n",
+                            {}});
+
+  // A chain of functions calling each other.
+  constexpr int FN_COUNT = 500;
+  string manyFunctions{};
+  for (int i = 0; i < FN_COUNT; i++) {
+    manyFunctions += "fn f" + to_string(i) + "(n) {\n  f(1)\n  r(7)\n  if (n > 0) {\n    f" +
+                     to_string((i + 1) % FN_COUNT) + "(n - 1)\n  }\n}\n";
+  }
+  manyFunctions += "intvar(\"rounds\", 1, 200, 50)\nloop (rounds) {\n  f0(" + to_string(FN_COUNT) + ")\n}\n";
+  cases.push_back(BenchCase{"stress/many_functions", manyFunctions, {}});
+
+  return cases;
+}
+
+vector<BenchCase> exampleCases(string const& dir) {
+  vector<BenchCase> cases{};
+
+  error_code ec;
+  vector<filesystem::path> paths{};
+  for (auto const& entry : filesystem::directory_iterator(dir, ec)) {
+    if (entry.path().extension() == ".logo") paths.push_back(entry.path());
+  }
+  if (ec) WARN("Cannot list examples: %s", dir.c_str());
+  sort(paths.begin(), paths.end());
+
+  for (auto const& path : paths) {
+    string source;
+    if (!readFile(path.c_str(), source)) continue;
+    cases.push_back(BenchCase{path.string(), std::move(source), {}});
+  }
+
+  return cases;
+}
+
+// Starts a new peak RSS at the current RSS (Linux only, the peak of the whole process elsewhere).
+void resetPeakRss() {
+  ofstream clearRefs{"/proc/self/clear_refs"};
+  if (clearRefs.is_open()) clearRefs << "5";
+}
+
+// The peak RSS since resetPeakRss(), from VmHWM.
+long peakRssKb() {
+  ifstream status{"/proc/self/status"};
+  string line;
+  while (getline(status, line)) {
+    if (line.starts_with("VmHWM:")) return atol(line.c_str() + strlen("VmHWM:"));
+  }
+
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+VM makeVm(BenchCase const& benchCase, size_t lineBudget) {
+  VM vm{};
+  vm.worldSize = Vector2{1024.f, 768.f};
+  vm.reset();
+  vm.lineBudget = lineBudget;
+  for (auto const& [name, value] : benchCase.vars) vm.frames.front().variable(name) = Value((float)value);
+  return vm;
+}
+
+BenchResult runCase(BenchCase const& benchCase, BenchOptions const& options) {
+  BenchResult best{};
+  resetPeakRss();
+
+  for (int i = 0; i < options.repeat; i++) {
+    VM vm = makeVm(benchCase, options.lineBudget);
+    RunTimes times{};
+
+    AllocStats allocsBefore = allocStats();
+    auto program = compileLogo(benchCase.source, &times);
+    if (program.has_value()) executeLogo(program.value(), &vm, &times);
+    AllocStats allocs = allocStats() - allocsBefore;
+
+    if (i == 0 || times.execute * 1000.f < best.executeMs) {
+      best.executeMs = times.execute * 1000.f;
+      best.statements = vm.executedStatements;
+      best.segments = vm.history.size();
+      best.isTruncated = vm.history.size() >= options.lineBudget;
+      best.allocs = allocs;
+    }
+    if (i == 0 || times.parse * 1000.f < best.parseMs) best.parseMs = times.parse * 1000.f;
+  }
+
+  best.peakRssKb = peakRssKb();
+  return best;
+}
+
+// The defaults, then every intvar at its min and max (the others at their defaults).
+vector<BenchCase> sweepCases(BenchCase const& benchCase, BenchOptions const& options) {
+  vector<BenchCase> cases{benchCase};
+
+  VM vm = makeVm(benchCase, options.lineBudget);
+  RunTimes times{};
+  auto program = compileLogo(benchCase.source, &times);
+  if (!program.has_value()) return cases;
+  executeLogo(program.value(), &vm, &times);
+
+  // Sorted so the rows keep their order between runs.
+  map<string, IntVar> intVars(vm.intVars.begin(), vm.intVars.end());
+  for (auto const& [name, intVar] : intVars) {
+    int defaultValue = (int)vm.frames.front().variable(name).floatVal;
+    for (int value : {intVar.min, intVar.max}) {
+      if (value == defaultValue) continue;
+      BenchCase swept{benchCase};
+      swept.vars.emplace_back(name, value);
+      cases.push_back(std::move(swept));
+    }
+  }
+
+  return cases;
+}
+
+string varsColumn(BenchCase const& benchCase) {
+  if (benchCase.vars.empty()) return "-";
+
+  string column{};
+  for (auto const& [name, value] : benchCase.vars) {
+    if (!column.empty()) column += ",";
+    column += name + "=" + to_string(value);
+  }
+  return column;
+}
+
+constexpr const char* TSV_HEADER =
+    "case\tvars\tparse_ms\texecute_ms\tstatements\tns_per_statement\tsegments\tsegments_per_sec\ttruncated\t"
+    "allocs\talloc_bytes\tpeak_rss_kb";
+
+string tsvRow(BenchCase const& benchCase, BenchResult const& result) {
+  char row[512];
+  snprintf(row, sizeof(row), "%s\t%s\t%.3f\t%.3f\t%lu\t%.2f\t%lu\t%.0f\t%d\t%lu\t%lu\t%ld", benchCase.name.c_str(),
+           varsColumn(benchCase).c_str(), result.parseMs, result.executeMs, result.statements,
+           result.nsPerStatement(), result.segments, result.segmentsPerSec(), result.isTruncated, result.allocs.count,
+           result.allocs.bytes, result.peakRssKb);
+  return row;
+}
+
+struct BaselineRow {
+  double nsPerStatement;
+  uint64_t allocs;
+};
+
+// Rows of a saved TSV by "case\tvars". The columns are found by their name in the header, nullopt if the file has no
+// header or misses a column: a baseline saved by another version of the benchmark can't be compared by position.
+optional<map<string, BaselineRow>> loadBaseline(string const& path) {
+  auto split = [](string const& line) -> vector<string> {
+    vector<string> cols{};
+    stringstream ss{line};
+    string col;
+    while (getline(ss, col, '\t')) cols.push_back(col);
+    return cols;
+  };
+
+  ifstream file{path};
+  string line;
+  if (!getline(file, line) || !line.starts_with("case\t")) return nullopt;
+
+  vector<string> header = split(line);
+  auto column = [&](const char* name) -> optional<size_t> {
+    auto it = find(header.begin(), header.end(), name);
+    return it == header.end() ? nullopt : optional<size_t>{it - header.begin()};
+  };
+  optional<size_t> caseCol = column("case");
+  optional<size_t> varsCol = column("vars");
+  optional<size_t> nsCol = column("ns_per_statement");
+  optional<size_t> allocsCol = column("allocs");
+  if (!caseCol.has_value() || !varsCol.has_value() || !nsCol.has_value() || !allocsCol.has_value()) return nullopt;
+
+  map<string, BaselineRow> rows{};
+  while (getline(file, line)) {
+    vector<string> cols = split(line);
+    if (cols.size() != header.size()) continue;
+
+    rows[cols[caseCol.value()] + "\t" + cols[varsCol.value()]] =
+        BaselineRow{stod(cols[nsCol.value()]), stoull(cols[allocsCol.value()])};
+  }
+
+  return rows;
+}
+
+// Prints the cases that got slower (or allocate more) than the baseline by more than the threshold, returns their
+// count. A baseline that can't be read counts as one.
+int compareWithBaseline(vector<pair<BenchCase, BenchResult>> const& results, BenchOptions const& options) {
+  auto loaded = loadBaseline(options.baselinePath);
+  if (!loaded.has_value()) {
+    fprintf(stderr, "%s is not a baseline of this benchmark (no header with the case, vars, ns_per_statement and "
+                    "allocs columns), save it again\n",
+            options.baselinePath.c_str());
+    return 1;
+  }
+  map<string, BaselineRow> const& baseline = loaded.value();
+  if (baseline.empty()) {
+    fprintf(stderr, "No baseline rows in %s\n", options.baselinePath.c_str());
+    return 0;
+  }
+
+  int regressionCount{0};
+  auto change = [](double from, double to) -> double { return from == 0.0 ? 0.0 : (to - from) / from * 100.0; };
+
+  for (auto const& [benchCase, result] : results) {
+    auto it = baseline.find(benchCase.name + "\t" + varsColumn(benchCase));
+    if (it == baseline.end()) continue;
+    BaselineRow const& base = it->second;
+
+    double timeChange = change(base.nsPerStatement, result.nsPerStatement());
+    double allocChange = change((double)base.allocs, (double)result.allocs.count);
+    bool isRegression = timeChange > options.threshold || allocChange > options.threshold;
+    if (isRegression) regressionCount++;
+
+    fprintf(stderr, "%s %s %s: %.2f -> %.2f ns/statement (%+.1f%%), %lu -> %lu allocs (%+.1f%%)\n",
+            isRegression ? "REGRESSION" : "ok        ", benchCase.name.c_str(), varsColumn(benchCase).c_str(),
+            base.nsPerStatement, result.nsPerStatement(), timeChange, base.allocs, result.allocs.count, allocChange);
+  }
+
+  fprintf(stderr, "%d regressions over %.0f%%\n", regressionCount, options.threshold);
+  return regressionCount;
+}
+
+// Synthetic source of at least `size` bytes with a token mix like the examples: function definitions with loops,
+// conditionals, recursion, builtin calls, assignments, arithmetic, variables and comments. Deterministic, so sizes
+// compare between runs.
+string generateSource(size_t size) {
+  string source{};
+  source.reserve(size + 1024);
+
+  for (int i = 0; source.size() < size; i++) {
+    string n = to_string(i);
+    source += "# shape " + n + "\n";
+    source += "fn shape" + n + "(size, angle, depth) {\n";
+    source += "  half" + n + " = size * 0.5 + depth / 3 - " + to_string(i % 7) + "\n";
+    source += "  loop (depth) {\n";
+    source += "    f(size)\n";
+    source += "    r(angle + " + to_string(i % 90) + ".25)\n";
+    source += "    if (size > " + to_string(i % 10 + 1) + ") {\n";
+    source += "      shape" + n + "(size * 0.7, angle, depth - 1)\n";
+    source += "    } else {\n";
+    source += "      t(half" + n + " % 4 + 1)\n";
+    source += "    }\n";
+    source += "  }\n";
+    source += "}\n";
+    source += "intvar(\"size" + n + "\", 1, 100, " + to_string(i % 100) + ")\n";
+    source += "shape" + n + "(size" + n + ", 30, 3)\n";
+  }
+
+  return source;
+}
+
+struct PhaseResult {
+  float ms{};
+  AllocStats allocs{};
+};
+
+string frontendRow(const char* phase, size_t size, size_t tokenCount, PhaseResult const& result) {
+  double seconds = max(result.ms / 1000.0, 1e-9);
+  char row[256];
+  snprintf(row, sizeof(row), "%s\t%lu\t%lu\t%.3f\t%.1f\t%.0f\t%lu\t%lu", phase, size, tokenCount, result.ms,
+           size / 1e6 / seconds, tokenCount / seconds, result.allocs.count, result.allocs.bytes);
+  return row;
+}
+
+int runFrontend(BenchOptions const& options) {
+  printf("phase\tsize_bytes\ttokens\tms\tmb_per_sec\ttokens_per_sec\tallocs\talloc_bytes\n");
+
+  for (size_t size = 1024; size <= options.maxSourceSize; size *= 10) {
+    string source = generateSource(size);
+    // Big inputs take long enough to be stable.
+    int repeat = source.size() <= 1024 * 1024 ? options.repeat : 1;
+
+    PhaseResult lex{};
+    PhaseResult parse{};
+    PhaseResult reparsed{};
+    size_t tokenCount{0};
+    // A keystroke in the editor: a digit in the middle of the source changes.
+    string edited = source;
+    size_t editPos = edited.find_first_of("0123456789", edited.size() / 2);
+    edited[editPos] = edited[editPos] == '1' ? '2' : '1';
+
+    try {
+      for (int i = 0; i < repeat; i++) {
+        AllocStats allocsBefore = allocStats();
+        auto t_start = chrono::steady_clock::now();
+        tokenCount = Lexer{source}.parse().size();
+        float lexMs = secondsSince(t_start) * 1000.f;
+        AllocStats lexAllocs = allocStats() - allocsBefore;
+
+        allocsBefore = allocStats();
+        t_start = chrono::steady_clock::now();
+        Lexer lexer{source};
+        Parser parser{lexer};
+        Ast::Program program = parser.parse();
+        float parseMs = secondsSince(t_start) * 1000.f;
+        AllocStats parseAllocs = allocStats() - allocsBefore;
+
+        allocsBefore = allocStats();
+        t_start = chrono::steady_clock::now();
+        optional<Reparse> edit = reparse(program, source, edited);
+        float reparseMs = secondsSince(t_start) * 1000.f;
+        AllocStats reparseAllocs = allocStats() - allocsBefore;
+        if (!edit.has_value()) throw runtime_error("Edit is not re-parsed incrementally");
+
+        if (i == 0 || lexMs < lex.ms) lex = PhaseResult{lexMs, lexAllocs};
+        if (i == 0 || parseMs < parse.ms) parse = PhaseResult{parseMs, parseAllocs};
+        if (i == 0 || reparseMs < reparsed.ms) reparsed = PhaseResult{reparseMs, reparseAllocs};
+      }
+    } catch (runtime_error& e) {
+      WARN("Generated source does not compile: %s", e.what());
+      return EXIT_FAILURE;
+    }
+
+    printf("%s\n", frontendRow("lex", source.size(), tokenCount, lex).c_str());
+    printf("%s\n", frontendRow("parse", source.size(), tokenCount, parse).c_str());
+    printf("%s\n", frontendRow("reparse", source.size(), tokenCount, reparsed).c_str());
+    fflush(stdout);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+bool parseArgs(int argc, char** args, BenchOptions& options) {
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(args[i], "--examples") == 0 && hasValue) {
+      options.examplesDir = args[++i];
+    } else if (strcmp(args[i], "--repeat") == 0 && hasValue) {
+      options.repeat = max(1, atoi(args[++i]));
+    } else if (strcmp(args[i], "--budget") == 0 && hasValue) {
+      options.lineBudget = strtoull(args[++i], nullptr, 10);
+    } else if (strcmp(args[i], "--filter") == 0 && hasValue) {
+      options.filter = args[++i];
+    } else if (strcmp(args[i], "--baseline") == 0 && hasValue) {
+      options.baselinePath = args[++i];
+    } else if (strcmp(args[i], "--save-baseline") == 0 && hasValue) {
+      options.saveBaselinePath = args[++i];
+    } else if (strcmp(args[i], "--threshold") == 0 && hasValue) {
+      options.threshold = atof(args[++i]);
+    } else if (strcmp(args[i], "--frontend") == 0) {
+      options.isFrontend = true;
+    } else if (strcmp(args[i], "--max-size") == 0 && hasValue) {
+      options.maxSourceSize = strtoull(args[++i], nullptr, 10);
+    } else {
+      WARN("Unknown or incomplete option: %s", args[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** args) {
+  SetTraceLogLevel(LOG_WARNING);
+
+  BenchOptions options{};
+  if (!parseArgs(argc, args, options)) return EXIT_FAILURE;
+  if (options.isFrontend) return runFrontend(options);
+
+  vector<BenchCase> baseCases = exampleCases(options.examplesDir);
+  for (auto& stressCase : stressCases()) baseCases.push_back(std::move(stressCase));
+
+  ostringstream tsv{};
+  tsv << TSV_HEADER << "\n";
+  printf("%s\n", TSV_HEADER);
+
+  vector<pair<BenchCase, BenchResult>> results{};
+  for (auto const& baseCase : baseCases) {
+    if (!options.filter.empty() && baseCase.name.find(options.filter) == string::npos) continue;
+
+    for (auto const& benchCase : sweepCases(baseCase, options)) {
+      BenchResult result = runCase(benchCase, options);
+      string row = tsvRow(benchCase, result);
+      printf("%s\n", row.c_str());
+      fflush(stdout);
+      tsv << row << "\n";
+      results.emplace_back(benchCase, result);
+    }
+  }
+
+  if (!options.saveBaselinePath.empty()) {
+    ofstream file{options.saveBaselinePath};
+    file << tsv.str();
+    if (!file.good()) WARN("Cannot write baseline: %s", options.saveBaselinePath.c_str());
+  }
+
+  int regressionCount = options.baselinePath.empty() ? 0 : compareWithBaseline(results, options);
+  return regressionCount == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cmath>
+#include <optional>
+#include <unordered_map>
+
+#include "raylib.h"
+
+using namespace std;
+
+namespace Ast {
+struct ExecutableFnNode;
+}  // namespace Ast
+
+// How much of a user function's drawing follows from its call, see Ast::callSafety.
+enum class CallSafety {
+  // Changes state beyond the turtle and its drawing: it's always executed.
+  Unsafe,
+  // Only changes the turtle and draws, but reads or sets the absolute turtle state or uses rand(): LOD can predict
+  // the size of its drawing (see CallSizeModel), nothing more.
+  Contained,
+  // Only moves relative to the turtle: the drawing is the same for every call with the same key, moved rigidly.
+  Relative,
+};
+
+// A user function call as far as its drawing is concerned: the function, its (number) arguments and the pen state it
+// starts with. For Relative functions everything else the call could depend on is ruled out by Ast::callSafety.
+struct CallKey {
+  static constexpr int MAX_ARGS = 8;
+
+  Ast::ExecutableFnNode const *fn;
+  array<float, MAX_ARGS> args;
+  int argCount;
+  bool isDown;
+  float thickness;
+
+  bool operator==(CallKey const &other) const = default;
+};
+
+struct CallKeyHash {
+  size_t operator()(CallKey const &key) const {
+    size_t h = hash<void const *>{}(key.fn);
+    for (int i = 0; i < key.argCount; i++) h = h * 31 + hash<float>{}(key.args[i]);
+    return h * 31 + hash<float>{}(key.thickness) * 2 + key.isDown;
+  }
+};
+
+// What a call did, relative to the turtle it started with (as if it started at the origin facing up).
+struct CallEffect {
+  Vector2 localMove;
+  float turn;
+  bool isDown;
+  float thickness;
+  // Every line of the call is within this distance of its start position.
+  float radius;
+  // Longest forward / backward move of the call, including the calls it made.
+  float maxForward;
+  int sampleCount;
+  bool isConsistent;
+};
+
+// How big the drawing of a function's calls is, learned from the executed calls without assuming that calls with the
+// same arguments draw the same (rand() angles, getx() / pos() to restore the turtle). Per argument and per octave of
+// its value it keeps the range of the drawing's radius per unit of the argument: calls of a recursion with similar
+// lengths draw similar shapes, so the argument the drawing scales with has narrow ranges and predicts the calls to
+// come. Octaves that weren't observed predict nothing, the radius is never extrapolated.
+struct CallSizeModel {
+  // Octaves of the arguments, [2^-OCTAVE_OFFSET, 2^(OCTAVE_COUNT - OCTAVE_OFFSET)).
+  static constexpr int OCTAVE_COUNT = 32;
+  static constexpr int OCTAVE_OFFSET = 16;
+  // An octave predicts the radius after this many calls...
+  static constexpr int MIN_SAMPLES = 4;
+  // ...whose radius per unit of the argument varied less than this factor.
+  static constexpr float MAX_RATIO_SPREAD = 2.f;
+
+  struct ArgOctave {
+    float minRatio{INFINITY};
+    float maxRatio{0.f};
+    int sampleCount{0};
+  };
+
+  array<array<ArgOctave, OCTAVE_COUNT>, CallKey::MAX_ARGS> octaves{};
+  // Every call ended at its start position and angle, with the pen up or down like before.
+  bool returnsToStart{true};
+  // Every call ended with the thickness it started with.
+  bool keepsThickness{true};
+  // Bit `i` is set while every call ended with the thickness of argument `i` (eg: `t(thick)` as a last move).
+  unsigned int thicknessArgs{~0u};
+
+  void learn(CallKey const &key, float radius, bool didReturn, float endThickness) {
+    returnsToStart = returnsToStart && didReturn;
+    keepsThickness = keepsThickness && endThickness == key.thickness;
+
+    for (int i = 0; i < key.argCount; i++) {
+      if (key.args[i] != endThickness) thicknessArgs &= ~(1u << i);
+      // Drawing nothing fits any scale.
+      if (radius <= 0.f) continue;
+
+      optional<int> octave = octaveOf(key.args[i]);
+      if (!octave) continue;
+      ArgOctave &o = octaves[i][*octave];
+      float ratio = radius / fabsf(key.args[i]);
+      o.minRatio = min(o.minRatio, ratio);
+      o.maxRatio = max(o.maxRatio, ratio);
+      o.sampleCount++;
+    }
+  }
+
+  // Radius of the drawing of a call, from the arguments that predict it. Nullopt while none does.
+  optional<float> predictRadius(CallKey const &key) const {
+    optional<float> radius{nullopt};
+    for (int i = 0; i < key.argCount; i++) {
+      optional<int> octave = octaveOf(key.args[i]);
+      if (!octave) continue;
+      ArgOctave const &o = octaves[i][*octave];
+      if (o.sampleCount < MIN_SAMPLES || o.maxRatio > o.minRatio * MAX_RATIO_SPREAD) continue;
+      radius = min(radius.value_or(INFINITY), o.maxRatio * fabsf(key.args[i]));
+    }
+    return radius;
+  }
+
+  // The argument every call ended with as thickness, if there is one.
+  optional<int> thicknessArg(int argCount) const {
+    unsigned int mask = thicknessArgs & ((1u << argCount) - 1u);
+    if (mask == 0) return nullopt;
+    return countr_zero(mask);
+  }
+
+ private:
+  // The float exponent, 0 and subnormals (exponent bits 0), infinity and NaN (255) fall outside of the octaves.
+  static optional<int> octaveOf(float arg) {
+    int octave = (int)((bit_cast<uint32_t>(arg) >> 23) & 0xffu) - 127 + OCTAVE_OFFSET;
+    if (octave < 0 || octave >= OCTAVE_COUNT) return nullopt;
+    return octave;
+  }
+};
+
+struct LearnedFunction {
+  // See Ast::callSafety.
+  CallSafety safety{CallSafety::Unsafe};
+  CallSizeModel size{};
+};
+
+// Extent of the drawing of the running call around its start, kept by the VM while learning: the lines drawn by the
+// call itself and the circles of the calls it made.
+struct CallExtent {
+  Vector2 start{};
+  float maxDistanceSq{0.f};
+  float maxHalfThickness{0.f};
+  float circleRadius{0.f};
+
+  void addLine(Vector2 from, Vector2 to, float thickness) {
+    maxDistanceSq = max(maxDistanceSq, max(distanceSq(from), distanceSq(to)));
+    maxHalfThickness = max(maxHalfThickness, thickness / 2.f);
+  }
+
+  void addCircle(Vector2 center, float radius) {
+    circleRadius = max(circleRadius, sqrtf(distanceSq(center)) + radius);
+  }
+
+  float radius() const {
+    return max(circleRadius, maxDistanceSq > 0.f ? sqrtf(maxDistanceSq) + maxHalfThickness : 0.f);
+  }
+
+ private:
+  float distanceSq(Vector2 p) const {
+    return (p.x - start.x) * (p.x - start.x) + (p.y - start.y) * (p.y - start.y);
+  }
+};
+
+// Opt-in execution culling and level of detail, both built on what is learned from observing user function calls.
+// Effects are learned from calls with the same key: after MIN_SAMPLES calls that agreed on the effect, the call is
+// trusted.
+//
+// Culling: calls whose drawing is known to land outside of `rect` are not executed, only their effect is applied.
+// LOD: calls whose drawing is predicted to stay within `lodThreshold` pixels of their start at `lodScale` are not
+// executed either, their drawing is approximated with a single line (see Ast::FnCallNode::pruneCall). Calls that return
+// to their start are predicted by the CallSizeModel of their function, others need a trusted effect whose every move
+// is shorter than the threshold.
+struct CallCulling {
+  static constexpr int MIN_SAMPLES = 2;
+  // Arguments that change with every call (eg: a length scaled down through a recursion) make new keys all the time,
+  // once the effects reach this size they are learned anew.
+  static constexpr size_t MAX_EFFECTS = 1 << 16;
+  // Tolerance of the effect comparison, relative to the radius.
+  static constexpr float EFFECT_EPSILON = 1e-3f;
+
+  bool isEnabled{false};
+  Rectangle rect{};
+
+  bool isLodEnabled{false};
+  // Pixels per world unit the drawing is made for.
+  float lodScale{1.f};
+  float lodThreshold{0.5f};
+
+  unordered_map<CallKey, CallEffect, CallKeyHash> effects{};
+  unordered_map<Ast::ExecutableFnNode const *, LearnedFunction> functions{};
+  // Longest move of the running call so far, maintained by VM::forward.
+  float maxForward{0.f};
+  CallExtent extent{};
+
+  int skippedCallCount{0};
+  int prunedCallCount{0};
+
+  bool isLearning() const {
+    return isEnabled || isLodEnabled;
+  }
+
+  // Drops everything learned, the function nodes the keys point to may be gone.
+  void clear() {
+    effects.clear();
+    functions.clear();
+  }
+
+  bool isOutside(Vector2 center, float radius) const {
+    return center.x + radius < rect.x || center.x - radius > rect.x + rect.width || center.y + radius < rect.y ||
+           center.y - radius > rect.y + rect.height;
+  }
+
+  // Records an observed call. `effect` is a single sample.
+  void learn(CallKey const &key, CallEffect effect) {
+    if (effects.size() >= MAX_EFFECTS && !effects.contains(key)) effects.clear();
+
+    auto [it, isNew] = effects.try_emplace(key, effect);
+    if (isNew) return;
+
+    CallEffect &known = it->second;
+    if (!known.isConsistent) return;
+
+    float tolerance = EFFECT_EPSILON * max(1.f, max(known.radius, effect.radius));
+    known.isConsistent = fabsf(known.localMove.x - effect.localMove.x) <= tolerance &&
+                         fabsf(known.localMove.y - effect.localMove.y) <= tolerance &&
+                         fabsf(known.turn - effect.turn) <= 1e-3f && known.isDown == effect.isDown &&
+                         known.thickness == effect.thickness;
+    known.radius = max(known.radius, effect.radius);
+    known.maxForward = max(known.maxForward, effect.maxForward);
+    known.sampleCount++;
+  }
+
+  // Effect of a call that can be trusted, nullptr if it's still learning.
+  CallEffect const *trustedEffect(CallKey const &key) const {
+    if (effects.empty()) return nullptr;
+    auto it = effects.find(key);
+    if (it == effects.end() || !it->second.isConsistent || it->second.sampleCount < MIN_SAMPLES) return nullptr;
+    return &it->second;
+  }
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "util.h"
+
+using namespace std;
+
+// Tells when a file changed on disk, without touching the disk while nothing happens.
+//
+// On Linux the file's directory is watched with inotify (the file itself can't be: editors that save by writing a
+// temp file and renaming it over the original replace the watched inode). Events of other files are ignored. Editors
+// often save in several steps (truncate, write, rename), so events are debounced: a change is reported once no new
+// event came for DEBOUNCE_TIME. Elsewhere, or when inotify is not available, the modification time is polled every
+// POLL_INTERVAL.
+struct FileWatcher {
+  static constexpr chrono::milliseconds DEBOUNCE_TIME{100};
+  static constexpr chrono::milliseconds POLL_INTERVAL{500};
+
+  FileWatcher() = default;
+  FileWatcher(const FileWatcher &) = delete;
+  FileWatcher &operator=(const FileWatcher &) = delete;
+
+  ~FileWatcher() {
+    stop();
+  }
+
+  void watch(string const &path) {
+    stop();
+
+    filePath = filesystem::absolute(path);
+    fileName = filePath.filename().string();
+    isPending = false;
+    lastWriteTime = readLastWriteTime();
+    lastPollTime = chrono::steady_clock::now();
+
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd >= 0) {
+      watchDescriptor = inotify_add_watch(inotifyFd, filePath.parent_path().c_str(),
+                                          IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE);
+    }
+
+    if (inotifyFd < 0 || watchDescriptor < 0) {
+      WARN("Cannot watch %s with inotify, polling it instead", filePath.c_str());
+      stop();
+    }
+#endif
+  }
+
+  // True once per settled change.
+  bool poll() {
+    if (filePath.empty()) return false;
+
+    auto now = chrono::steady_clock::now();
+
+    if (inotifyFd >= 0) {
+      if (readEvents()) {
+        isPending = true;
+        lastEventTime = now;
+      }
+    } else if (now - lastPollTime >= POLL_INTERVAL) {
+      lastPollTime = now;
+      auto writeTime = readLastWriteTime();
+      if (writeTime != lastWriteTime) {
+        lastWriteTime = writeTime;
+        isPending = true;
+        lastEventTime = now;
+      }
+    }
+
+    if (isPending && now - lastEventTime >= DEBOUNCE_TIME) {
+      isPending = false;
+      return true;
+    }
+
+    return false;
+  }
+
+ private:
+  filesystem::path filePath{};
+  // Kept apart from filePath, so the events can be matched without building a string per poll.
+  string fileName{};
+  int inotifyFd{-1};
+  int watchDescriptor{-1};
+  bool isPending{false};
+  chrono::steady_clock::time_point lastEventTime{};
+  chrono::steady_clock::time_point lastPollTime{};
+  filesystem::file_time_type lastWriteTime{};
+
+  void stop() {
+#ifdef __linux__
+    if (inotifyFd >= 0) close(inotifyFd);
+#endif
+    inotifyFd = -1;
+    watchDescriptor = -1;
+  }
+
+  // Drains the queued events, true if any of them was about the watched file.
+  bool readEvents() {
+    bool didChange{false};
+
+#ifdef __linux__
+    alignas(inotify_event) char buffer[4096];
+
+    while (true) {
+      ssize_t len = read(inotifyFd, buffer, sizeof(buffer));
+      if (len <= 0) break;
+
+      for (char *p = buffer; p < buffer + len;) {
+        auto *event = reinterpret_cast<inotify_event *>(p);
+        if (event->len > 0 && strcmp(event->name, fileName.c_str()) == 0) didChange = true;
+        p += sizeof(inotify_event) + event->len;
+      }
+    }
+#endif
+
+    return didChange;
+  }
+
+  filesystem::file_time_type readLastWriteTime() const {
+    error_code ec;
+    auto writeTime = filesystem::last_write_time(filePath, ec);
+    return ec ? filesystem::file_time_type{} : writeTime;
+  }
+};
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ast.h"
+#include "config.h"
+#include "logo.h"
+#include "memory_stats.h"
+#include "raylib.h"
+#include "sampler.h"
+#include "soft_raster.h"
+#include "trace.h"
+#include "util.h"
+#include "vector_export.h"
+#include "vm.h"
+
+using namespace std;
+
+struct HeadlessJob {
+  string scriptPath{};
+  vector<pair<string, float>> vars{};
+  string outPath{};
+};
+
+// Batch mode without a window, GL context or UI: every job runs a script through the lexer / parser / VM and
+// writes the drawing, rasterized on the CPU, into a PNG file - or streams it into an SVG / PDF file when the output
+// file has that extension.
+//
+// plogo --headless [--size WxH] [--scale N] [--precision P] [--lod PX] [--profile FILE] [--trace FILE] [--sample FILE]
+//   [--jobs FILE] SCRIPT [--set NAME=VALUE ...] [--out FILE] [SCRIPT ...]
+//
+// Every SCRIPT starts a new job, `--set` and `--out` apply to the job before them. `--lod` approximates the calls
+// whose moves are all shorter than PX pixels at the output scale. `--profile` writes the function profile of every job
+// into a JSON file, `--trace` the phases of the jobs as Chrome trace events, `--sample` the sampled call stacks of
+// all jobs as folded stacks (a running batch can also be sampled by SIGUSR1, see Sampler). A jobs file holds one job
+// per line in the same format (eg: `examples/tree.logo --set size=120 --out tree_120.png`).
+struct Headless {
+  vector<HeadlessJob> jobs{};
+  int width{config.win_w};
+  int height{config.win_h};
+  float scale{1.f};
+  VectorExportOptions exportOptions{};
+  // Level of detail threshold in pixels, 0 is off.
+  float lodThreshold{0.f};
+  string profilePath{};
+  string tracePath{};
+  string samplePath{};
+
+  bool parseArgs(int argc, char **args) {
+    vector<string> tokens{};
+    for (int i = 1; i < argc; i++) tokens.emplace_back(args[i]);
+    return parseTokens(tokens);
+  }
+
+  int run() {
+    SetTraceLogLevel(LOG_WARNING);
+
+    if (jobs.empty()) {
+      WARN("No jobs to run");
+      return EXIT_FAILURE;
+    }
+
+    if (!profilePath.empty()) {
+      profileFile.open(profilePath);
+      if (!profileFile) {
+        WARN("Cannot write profile: %s", profilePath.c_str());
+        return EXIT_FAILURE;
+      }
+      profileFile << "{\"jobs\": [";
+    }
+
+    if (!samplePath.empty()) sampler.start(samplePath);
+
+    auto t_start = chrono::steady_clock::now();
+    int failCount{0};
+
+    for (int i = 0; i < (int)jobs.size(); i++) {
+      if (!runJob(i)) failCount++;
+    }
+
+    if (profileFile.is_open()) profileFile << "\n]}\n";
+    if (sampler.isSampling() && !sampler.stop()) failCount++;
+
+    if (!tracePath.empty()) {
+      ofstream traceFile{tracePath};
+      tracer.writeChromeJson(traceFile);
+      if (!traceFile.good()) WARN("Cannot write trace: %s", tracePath.c_str());
+    }
+
+    float totalTime = chrono::duration<float>(chrono::steady_clock::now() - t_start).count();
+    printf("%d jobs (%d failed) in %.3f s, %.0f jobs/min\n", (int)jobs.size(), failCount, totalTime,
+           jobs.size() / max(totalTime, 1e-6f) * 60.f);
+    printf("memory live/peak KB: %s\n", memoryStats.summary().c_str());
+
+    return failCount == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+ private:
+  unordered_map<string, string> sources{};
+  SoftRasterizer rasterizer{};
+  vector<Color> pixels{};
+  ofstream profileFile{};
+  int profiledJobCount{0};
+
+  bool parseTokens(vector<string> const &tokens) {
+    for (size_t i = 0; i < tokens.size(); i++) {
+      string const &token = tokens[i];
+      bool hasValue = i + 1 < tokens.size();
+
+      if (token == "--headless") {
+        continue;
+      } else if (token == "--size" && hasValue) {
+        if (sscanf(tokens[++i].c_str(), "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+          WARN("Invalid size: %s (expected WxH)", tokens[i].c_str());
+          return false;
+        }
+      } else if (token == "--scale" && hasValue) {
+        scale = strtof(tokens[++i].c_str(), nullptr);
+        if (scale <= 0.f) {
+          WARN("Invalid scale: %s", tokens[i].c_str());
+          return false;
+        }
+      } else if (token == "--precision" && hasValue) {
+        exportOptions.precision = strtof(tokens[++i].c_str(), nullptr);
+        if (exportOptions.precision <= 0.f) {
+          WARN("Invalid precision: %s", tokens[i].c_str());
+          return false;
+        }
+      } else if (token == "--lod" && hasValue) {
+        lodThreshold = strtof(tokens[++i].c_str(), nullptr);
+        if (lodThreshold < 0.f) {
+          WARN("Invalid LOD threshold: %s", tokens[i].c_str());
+          return false;
+        }
+      } else if (token == "--profile" && hasValue) {
+        profilePath = tokens[++i];
+      } else if (token == "--trace" && hasValue) {
+        tracePath = tokens[++i];
+      } else if (token == "--sample" && hasValue) {
+        samplePath = tokens[++i];
+      } else if (token == "--jobs" && hasValue) {
+        if (!parseJobsFile(tokens[++i])) return false;
+      } else if (token == "--set" && hasValue) {
+        string assignment = tokens[++i];
+        size_t eqPos = assignment.find('=');
+        if (jobs.empty() || eqPos == string::npos) {
+          WARN("Invalid --set %s (expected SCRIPT --set NAME=VALUE)", assignment.c_str());
+          return false;
+        }
+        jobs.back().vars.emplace_back(assignment.substr(0, eqPos), strtof(assignment.c_str() + eqPos + 1, nullptr));
+      } else if (token == "--out" && hasValue) {
+        if (jobs.empty()) {
+          WARN("--out %s has no script before it", tokens[i + 1].c_str());
+          return false;
+        }
+        jobs.back().outPath = tokens[++i];
+      } else if (token.starts_with("--")) {
+        WARN("Unknown or incomplete option: %s", token.c_str());
+        return false;
+      } else {
+        HeadlessJob job{};
+        job.scriptPath = token;
+        jobs.push_back(job);
+      }
+    }
+
+    for (auto &job : jobs) {
+      if (job.outPath.empty()) job.outPath = defaultOutPath(job.scriptPath);
+    }
+
+    return true;
+  }
+
+  bool parseJobsFile(string const &path) {
+    ifstream file{path};
+    if (!file) {
+      WARN("Cannot open jobs file: %s", path.c_str());
+      return false;
+    }
+
+    string line;
+    while (getline(file, line)) {
+      vector<string> tokens{};
+      char *saveptr{nullptr};
+      for (char *token = strtok_r(line.data(), " \t\r", &saveptr); token != nullptr;
+           token = strtok_r(nullptr, " \t\r", &saveptr)) {
+        tokens.emplace_back(token);
+      }
+
+      if (tokens.empty() || tokens.front().starts_with("#")) continue;
+      if (!parseTokens(tokens)) return false;
+    }
+
+    return true;
+  }
+
+  void writeProfile(int jobIdx, Profiler const &profiler, RunTimes const &runTimes) {
+    HeadlessJob const &job = jobs[jobIdx];
+
+    profileFile << (profiledJobCount++ == 0 ? "\n" : ",\n") << "{\"script\": ";
+    Profiler::writeJsonString(profileFile, job.scriptPath);
+    profileFile << ", \"out\": ";
+    Profiler::writeJsonString(profileFile, job.outPath);
+    profileFile << ", \"execute_ms\": " << runTimes.execute * 1000.f << ", \"functions\": ";
+    profiler.writeJson(profileFile);
+    profileFile << "}";
+  }
+
+  static string defaultOutPath(string const &scriptPath) {
+    size_t dotPos = scriptPath.rfind('.');
+    size_t slashPos = scriptPath.rfind('/');
+    if (dotPos == string::npos || (slashPos != string::npos && dotPos < slashPos)) return scriptPath + ".png";
+    return scriptPath.substr(0, dotPos) + ".png";
+  }
+
+  string const *loadSource(string const &path) {
+    auto it = sources.find(path);
+    if (it != sources.end()) return &it->second;
+
+    string content;
+    if (!readFile(path.c_str(), content)) return nullptr;
+    return &sources.emplace(path, std::move(content)).first->second;
+  }
+
+  bool runJob(int jobIdx) {
+    TRACE_SCOPE("job");
+    HeadlessJob const &job = jobs[jobIdx];
+
+    auto t_start = chrono::steady_clock::now();
+
+    string const *source = loadSource(job.scriptPath);
+    if (source == nullptr) {
+      WARN("Job %d: cannot read script %s", jobIdx + 1, job.scriptPath.c_str());
+      return false;
+    }
+
+    VM vm{};
+    vm.worldSize = Vector2{(float)width, (float)height};
+    vm.reset();
+    vm.culling.isLodEnabled = lodThreshold > 0.f;
+    vm.culling.lodThreshold = lodThreshold;
+    vm.culling.lodScale = scale;
+    vm.profiler.isEnabled = profileFile.is_open();
+    // Preset variables win over the intvar / floatvar defaults.
+    for (auto &[name, value] : job.vars) vm.frames.front().variable(name) = Value(value);
+
+    RunTimes runTimes{};
+    sampler.setScript(job.scriptPath);
+    bool isOk = runLogo(*source, &vm, &runTimes);
+
+    if (vm.profiler.isEnabled) writeProfile(jobIdx, vm.profiler, runTimes);
+
+    auto t_raster = chrono::steady_clock::now();
+    auto t_write = t_raster;
+
+    if (job.outPath.ends_with(".svg") || job.outPath.ends_with(".pdf")) {
+      TRACE_SCOPE("vector export");
+      ofstream file{job.outPath, ios::binary};
+      if (job.outPath.ends_with(".pdf")) {
+        exportPdf(vm.history, vm.worldSize, file, exportOptions);
+      } else {
+        exportSvg(vm.history, vm.worldSize, file, exportOptions);
+      }
+      isOk = file.good() && isOk;
+    } else {
+      int imageW = (int)(width * scale);
+      int imageH = (int)(height * scale);
+      rasterizer.render(vm.history, Vector2{0.f, 0.f}, scale, imageW, imageH, WHITE, pixels);
+
+      t_write = chrono::steady_clock::now();
+      TRACE_SCOPE("write image");
+      Image image{pixels.data(), imageW, imageH, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+      isOk = ExportImage(image, job.outPath.c_str()) && isOk;
+    }
+
+    auto t_end = chrono::steady_clock::now();
+    printf("job %d/%d %s -> %s: %s, %lu edges, run %.2f ms, raster %.2f ms, write %.2f ms, total %.2f ms\n",
+           jobIdx + 1, (int)jobs.size(), job.scriptPath.c_str(), job.outPath.c_str(), isOk ? "ok" : "FAILED",
+           vm.history.size(), runTimes.total() * 1000.f, msBetween(t_raster, t_write), msBetween(t_write, t_end),
+           msBetween(t_start, t_end));
+
+    // The errors of the job belong under its line, the log is not shown in batch mode and must not carry them over.
+    for (auto const &line : appLog.lines) printf("  %s\n", line.c_str());
+    appLog.clear();
+
+    return isOk;
+  }
+
+  static float msBetween(chrono::steady_clock::time_point from, chrono::steady_clock::time_point to) {
+    return chrono::duration<float, milli>(to - from).count();
+  }
+};
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <vector>
+
+#include "ast.h"
+#include "raylib.h"
+#include "vm.h"
+
+using namespace std;
+
+// Uniform grid over VM::history. It's bulk loaded after execution (counting sort of the lines into the cells they
+// cross), so region queries and hit-tests only need to look at the lines of the overlapping cells.
+struct HistoryIndex {
+  // Average number of lines a cell should hold and the maximum cell count on one axis.
+  static constexpr float LINES_PER_CELL = 4.f;
+  static constexpr int MAX_CELLS_PER_AXIS = 1024;
+  static constexpr int MAX_UNINDEXED_LINES = 4096;
+
+  Rectangle bounds{};
+  int cols{0};
+  int rows{0};
+  float cellW{1.f};
+  float cellH{1.f};
+  // Cell `i` holds the line indices cellItems[cellStart[i]] .. cellItems[cellStart[i + 1] - 1].
+  vector<unsigned int> cellStart{};
+  vector<unsigned int> cellItems{};
+
+  size_t indexedSize{0};
+  unsigned int indexedGeneration{0};
+  float maxThickness{0.f};
+
+  float lastBuildTime{};
+  mutable float lastQueryTime{};
+
+  void build(VM const &vm) {
+    auto t_start = chrono::steady_clock::now();
+
+    auto const &history = vm.history;
+    indexedSize = history.size();
+    indexedGeneration = vm.historyGeneration;
+
+    cellStart.clear();
+    cellItems.clear();
+    seenStamp.assign(history.size(), 0);
+    stamp = 0;
+    maxThickness = 0.f;
+
+    if (history.empty()) {
+      cols = rows = 0;
+      lastBuildTime = elapsedSince(t_start);
+      return;
+    }
+
+    float minx = history.front().from.x;
+    float miny = history.front().from.y;
+    float maxx = minx;
+    float maxy = miny;
+    for (auto const &line : history) {
+      Rectangle r = lineBounds(line);
+      minx = min(minx, r.x);
+      miny = min(miny, r.y);
+      maxx = max(maxx, r.x + r.width);
+      maxy = max(maxy, r.y + r.height);
+      maxThickness = max(maxThickness, line.thickness);
+    }
+    bounds = Rectangle{minx, miny, max(maxx - minx, 1.f), max(maxy - miny, 1.f)};
+
+    float cellCount = max(1.f, (float)history.size() / LINES_PER_CELL);
+    float cellSize = sqrtf(bounds.width * bounds.height / cellCount);
+    cols = toRange((int)ceilf(bounds.width / cellSize), 1, MAX_CELLS_PER_AXIS);
+    rows = toRange((int)ceilf(bounds.height / cellSize), 1, MAX_CELLS_PER_AXIS);
+    cellW = bounds.width / cols;
+    cellH = bounds.height / rows;
+
+    // Pass 1: count lines per cell, pass 2: prefix sum, pass 3: scatter.
+    cellStart.assign(cols * rows + 1, 0);
+    for (auto const &line : history) {
+      forEachLineCell(line, [&](int cell) { cellStart[cell + 1]++; });
+    }
+
+    for (int i = 1; i <= cols * rows; i++) cellStart[i] += cellStart[i - 1];
+
+    cellItems.resize(cellStart.back());
+    vector<unsigned int> cursor(cellStart.begin(), cellStart.end() - 1);
+    for (unsigned int i = 0; i < history.size(); i++) {
+      forEachLineCell(history[i], [&](int cell) { cellItems[cursor[cell]++] = i; });
+    }
+
+    lastBuildTime = elapsedSince(t_start);
+  }
+
+  bool isStale(VM const &vm) const {
+    return indexedGeneration != vm.historyGeneration || indexedSize != vm.history.size();
+  }
+
+  // Lines appended after the build are scanned linearly by the queries (see forEachCandidate), it's only worth
+  // rebuilding once that tail gets long.
+  bool needsRebuild(VM const &vm) const {
+    if (indexedGeneration != vm.historyGeneration || indexedSize > vm.history.size()) return true;
+    return vm.history.size() - indexedSize > max((size_t)MAX_UNINDEXED_LINES, indexedSize / 4);
+  }
+
+  // Collects the indices (in history order) of the lines that cross a cell overlapping `area` and whose bounding box
+  // intersects it.
+  void query(VM const &vm, Rectangle area, vector<unsigned int> &out) const {
+    auto t_start = chrono::steady_clock::now();
+
+    out.clear();
+    forEachCandidate(vm, area, [&](unsigned int lineIdx) {
+      if (overlaps(lineBounds(vm.history[lineIdx]), area)) out.push_back(lineIdx);
+    });
+
+    // Lines are drawn on top of each other, the original order must be kept.
+    sort(out.begin(), out.end());
+
+    lastQueryTime = elapsedSince(t_start);
+  }
+
+  // Index of the topmost line within `radius` distance to `p`.
+  optional<unsigned int> hitTest(VM const &vm, Vector2 p, float radius) const {
+    optional<unsigned int> hit{nullopt};
+
+    Rectangle area{p.x - radius, p.y - radius, radius * 2.f, radius * 2.f};
+    forEachCandidate(vm, area, [&](unsigned int lineIdx) {
+      auto const &line = vm.history[lineIdx];
+      if (distanceToLine(p, line) > radius + line.thickness / 2.f) return;
+      if (!hit.has_value() || hit.value() < lineIdx) hit = lineIdx;
+    });
+
+    return hit;
+  }
+
+  static Rectangle lineBounds(Line const &line) {
+    float halfThickness = line.thickness / 2.f;
+    float minx = min(line.from.x, line.to.x) - halfThickness;
+    float miny = min(line.from.y, line.to.y) - halfThickness;
+    float maxx = max(line.from.x, line.to.x) + halfThickness;
+    float maxy = max(line.from.y, line.to.y) + halfThickness;
+    return Rectangle{minx, miny, maxx - minx, maxy - miny};
+  }
+
+  static bool overlaps(Rectangle a, Rectangle b) {
+    return a.x <= b.x + b.width && b.x <= a.x + a.width && a.y <= b.y + b.height && b.y <= a.y + a.height;
+  }
+
+  static float distanceToLine(Vector2 p, Line const &line) {
+    float dx = line.to.x - line.from.x;
+    float dy = line.to.y - line.from.y;
+    float lenSq = dx * dx + dy * dy;
+    float t = lenSq > 0.f ? ((p.x - line.from.x) * dx + (p.y - line.from.y) * dy) / lenSq : 0.f;
+    t = toRange(t, 0.f, 1.f);
+    return hypotf(p.x - (line.from.x + t * dx), p.y - (line.from.y + t * dy));
+  }
+
+ private:
+  // Per line stamp of the last query that visited it - dedups lines registered in multiple cells without sorting.
+  mutable vector<unsigned int> seenStamp{};
+  mutable unsigned int stamp{0};
+
+  void nextStamp() const {
+    if (++stamp == 0) {
+      fill(seenStamp.begin(), seenStamp.end(), 0);
+      stamp = 1;
+    }
+  }
+
+  // Calls `fn` once for every line that may intersect `area`: the lines of the overlapping cells plus the ones
+  // appended since the last build.
+  template <typename F>
+  void forEachCandidate(VM const &vm, Rectangle area, F fn) const {
+    if (indexedGeneration != vm.historyGeneration || indexedSize > vm.history.size()) return;
+
+    nextStamp();
+    forEachCell(area, [&](int cell) {
+      for (unsigned int i = cellStart[cell]; i < cellStart[cell + 1]; i++) {
+        unsigned int lineIdx = cellItems[i];
+        if (seenStamp[lineIdx] == stamp) continue;
+        seenStamp[lineIdx] = stamp;
+
+        fn(lineIdx);
+      }
+    });
+
+    for (size_t i = indexedSize; i < vm.history.size(); i++) fn((unsigned int)i);
+  }
+
+  template <typename F>
+  void forEachCell(Rectangle area, F fn) const {
+    if (cols == 0 || rows == 0) return;
+
+    int x0 = (int)floorf((area.x - bounds.x) / cellW);
+    int y0 = (int)floorf((area.y - bounds.y) / cellH);
+    int x1 = (int)floorf((area.x + area.width - bounds.x) / cellW);
+    int y1 = (int)floorf((area.y + area.height - bounds.y) / cellH);
+    if (x1 < 0 || y1 < 0 || x0 >= cols || y0 >= rows) return;
+
+    x0 = toRange(x0, 0, cols - 1);
+    y0 = toRange(y0, 0, rows - 1);
+    x1 = toRange(x1, 0, cols - 1);
+    y1 = toRange(y1, 0, rows - 1);
+
+    for (int y = y0; y <= y1; y++) {
+      for (int x = x0; x <= x1; x++) {
+        fn(y * cols + x);
+      }
+    }
+  }
+
+  // Calls `fn` for the cells the line (widened by its thickness) crosses, column by column: in each column only the
+  // rows between the ends of the part of the line within it. A long diagonal is registered in O(cols + rows) cells
+  // instead of every cell of its bounding box.
+  template <typename F>
+  void forEachLineCell(Line const &line, F fn) const {
+    if (cols == 0 || rows == 0) return;
+
+    float halfThickness = line.thickness / 2.f;
+    Vector2 a = line.from;
+    Vector2 b = line.to;
+    if (a.x > b.x) swap(a, b);
+    float dx = b.x - a.x;
+    float dy = b.y - a.y;
+
+    int x0 = toRange((int)floorf((a.x - halfThickness - bounds.x) / cellW), 0, cols - 1);
+    int x1 = toRange((int)floorf((b.x + halfThickness - bounds.x) / cellW), 0, cols - 1);
+    for (int x = x0; x <= x1; x++) {
+      float left = bounds.x + x * cellW - halfThickness;
+      float right = left + cellW + 2.f * halfThickness;
+      float t0 = dx > 0.f ? toRange((left - a.x) / dx, 0.f, 1.f) : 0.f;
+      float t1 = dx > 0.f ? toRange((right - a.x) / dx, 0.f, 1.f) : 1.f;
+      float ya = a.y + dy * t0;
+      float yb = a.y + dy * t1;
+
+      int y0 = toRange((int)floorf((min(ya, yb) - halfThickness - bounds.y) / cellH), 0, rows - 1);
+      int y1 = toRange((int)floorf((max(ya, yb) + halfThickness - bounds.y) / cellH), 0, rows - 1);
+      for (int y = y0; y <= y1; y++) fn(y * cols + x);
+    }
+  }
+
+  static float elapsedSince(chrono::steady_clock::time_point t_start) {
+    return chrono::duration<float>(chrono::steady_clock::now() - t_start).count();
+  }
+};
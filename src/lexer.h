@@ -1,15 +1,18 @@
 #pragma once
 
+#include <charconv>
+#include <cstdint>
 #include <exception>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include "memory_stats.h"
 #include "util.h"
 
 using namespace std;
 
-const vector<string> keywords{"fn", "if", "else", "loop"};
-
 enum class LexemeKind {
   Keyword,
   Number,
@@ -25,144 +28,222 @@ enum class LexemeKind {
   Assignment,
 };
 
-int precedence(string s) {
-  if (s == "<" || s == ">" || s == "<=" || s == ">=" || s == "==") {
-    return 3;
-  } else if (s == "+" || s == "-") {
-    return 2;
-  } else if (s == "*" || s == "/" || s == "%") {
-    return 1;
-  }
+// Keywords are the first symbols of every lexer, in this order.
+enum class KeywordKind {
+  Fn,
+  If,
+  Else,
+  Loop,
+};
+
+constexpr string_view KEYWORDS[] = {"fn", "if", "else", "loop"};
 
-  THROW("Unexpected op in precedence check: %s", s.c_str());
-  return -1;  // Unreachable, to satisfy return expectation.
+enum class OpKind {
+  Add,
+  Sub,
+  Div,
+  Mul,
+  Mod,
+  Lt,
+  Gt,
+  Lte,
+  Gte,
+  Eq,
+};
+
+// Indexed by OpKind, a lower value binds tighter.
+constexpr int OP_PRECEDENCE[] = {2, 2, 1, 1, 1, 3, 3, 3, 3, 3};
+static_assert(sizeof(OP_PRECEDENCE) / sizeof(OP_PRECEDENCE[0]) == static_cast<size_t>(OpKind::Eq) + 1);
+
+constexpr int precedence(OpKind op) {
+  return OP_PRECEDENCE[static_cast<int>(op)];
 }
 
+// An interned name or keyword, unique per lexer.
+using Symbol = uint32_t;
+
 struct Lexeme {
   LexemeKind kind;
-  string v{};
+  // Views the source (empty for punctuation), the source outlives the lexemes.
+  string_view v{};
+  // Set for numbers.
+  float number{0.f};
+  // Set for operators.
+  OpKind op{};
+  // Set for names and keywords.
+  Symbol symbol{0};
+  // Offset of the lexeme in the source.
+  size_t pos{0};
 
+  // A placeholder for lexeme buffers.
+  Lexeme() : kind(LexemeKind::Semicolon) {
+  }
   Lexeme(LexemeKind kind) : kind(kind) {
   }
-  Lexeme(LexemeKind kind, string v) : kind(kind), v(v) {
+  Lexeme(LexemeKind kind, string_view v) : kind(kind), v(v) {
+  }
+
+  bool isKeyword(KeywordKind keyword) const {
+    return kind == LexemeKind::Keyword && symbol == static_cast<Symbol>(keyword);
   }
 };
 
+// The lexer only views the source code, the caller keeps it alive while lexing.
 struct Lexer {
-  string code;
+  string_view code;
   size_t ptr = 0;
+  // Views the source like the lexemes, a name only allocates the first time it is seen.
+  unordered_map<string_view, Symbol, hash<string_view>, equal_to<string_view>,
+                TrackingAllocator<pair<const string_view, Symbol>, MemoryKind::Lexemes>>
+      symbols{};
 
-  Lexer(string code) : code(code) {
+  Lexer(string_view code) : code(code) {
+    for (string_view keyword : KEYWORDS) intern(keyword);
   }
   Lexer(const Lexer &code) = delete;
   Lexer(Lexer &&code) = delete;
   ~Lexer() {
   }
 
+  // All lexemes at once, the parser pulls them one by one instead.
   vector<Lexeme> parse() {
     vector<Lexeme> lexemes{};
+    Lexeme lexeme{};
+    while (nextLexeme(lexeme)) lexemes.push_back(lexeme);
+    return lexemes;
+  }
 
+  // False at the end of the source.
+  bool nextLexeme(Lexeme &lexeme) {
     while (true) {
       consumeSpaces();
-      if (isEnd()) break;
+      if (isEnd()) return false;
 
+      size_t start = ptr;
       char c = peek();
       if (isalpha(c) || c == '_') {
-        lexemes.push_back(readWord());
+        lexeme = readWord();
       } else if (isdigit(c)) {
-        lexemes.push_back(readNumber());
+        lexeme = readNumber();
       } else if (c == '"') {
-        lexemes.push_back(readString());
+        lexeme = readString();
       } else if (c == '(') {
-        lexemes.push_back(Lexeme(LexemeKind::ParenOpen));
+        lexeme = Lexeme(LexemeKind::ParenOpen);
         next();
       } else if (c == ')') {
-        lexemes.push_back(Lexeme(LexemeKind::ParenClose));
+        lexeme = Lexeme(LexemeKind::ParenClose);
         next();
       } else if (c == '{') {
-        lexemes.push_back(Lexeme(LexemeKind::BraceOpen));
+        lexeme = Lexeme(LexemeKind::BraceOpen);
         next();
       } else if (c == '}') {
-        lexemes.push_back(Lexeme(LexemeKind::BraceClose));
+        lexeme = Lexeme(LexemeKind::BraceClose);
         next();
       } else if (c == ',') {
-        lexemes.push_back(Lexeme(LexemeKind::Comma));
-        next();
-      } else if (c == '+' || c == '*' || c == '/' || c == '%') {
-        string opStr{c};
-        lexemes.push_back(Lexeme(LexemeKind::Op, opStr));
+        lexeme = Lexeme(LexemeKind::Comma);
         next();
+      } else if (c == '+' || c == '*' || c == '/' || c == '%' || c == '<' || c == '>') {
+        lexeme = readOp();
       } else if (c == '-') {
-        next();
-
-        if (isdigit(peek())) {
-          lexemes.push_back(readNumber(true));
+        if (ptr + 1 < code.size() && isdigit(code[ptr + 1])) {
+          lexeme = readNumber();
         } else {
-          string opStr{c};
-          lexemes.push_back(Lexeme(LexemeKind::Op, opStr));
+          lexeme = readOp();
         }
-      } else if (c == '<' || c == '>') {
-        next();
-        string opStr{c};
-        if (peek() == '=') opStr.push_back(next());
-        lexemes.push_back(Lexeme(LexemeKind::Op, opStr));
       } else if (c == '=') {
-        next();
-
-        if (peek() == '=') {
-          next();
-          lexemes.push_back(Lexeme(LexemeKind::Op, "=="));
+        if (ptr + 1 < code.size() && code[ptr + 1] == '=') {
+          lexeme = readOp();
         } else {
-          lexemes.push_back(Lexeme(LexemeKind::Assignment));
+          lexeme = Lexeme(LexemeKind::Assignment);
+          next();
         }
       } else if (c == '#') {
         readWhile([](char c) -> bool { return c != '\n'; });
+        continue;
       } else {
         THROW("Unknown character in lexing <%c> at pos %d", c, ptr);
       }
+
+      lexeme.pos = start;
+      return true;
     }
+  }
 
-    return lexemes;
+  Symbol intern(string_view name) {
+    return symbols.try_emplace(name, static_cast<Symbol>(symbols.size())).first->second;
   }
 
   Lexeme readWord() {
-    string word = readWhile([](char c) -> bool { return isalnum(c) || c == '_'; });
-    auto it = find(keywords.begin(), keywords.end(), word);
-    if (it == keywords.end()) {
-      return Lexeme(LexemeKind::Name, word);
-    } else {
-      return Lexeme(LexemeKind::Keyword, word);
-    }
+    Lexeme lexeme{LexemeKind::Name, readWhile([](char c) -> bool { return isalnum(c) || c == '_'; })};
+    lexeme.symbol = intern(lexeme.v);
+    if (lexeme.symbol < size(KEYWORDS)) lexeme.kind = LexemeKind::Keyword;
+    return lexeme;
+  }
+
+  // May start with a minus sign, the caller checked that a digit follows it.
+  Lexeme readNumber() {
+    size_t start = ptr;
+    if (peek() == '-') next();
+    readWhile([](char c) -> bool { return isdigit(c) || c == '.'; });
+
+    Lexeme lexeme{LexemeKind::Number, code.substr(start, ptr - start)};
+    // Like stof, a malformed tail ("1.2.3") is ignored.
+    from_chars(lexeme.v.data(), lexeme.v.data() + lexeme.v.size(), lexeme.number);
+    return lexeme;
   }
 
-  Lexeme readNumber(bool negative = false) {
-    string word;
+  Lexeme readOp() {
+    size_t start = ptr;
+    char c = next();
+    bool isEqualsNext = !isEnd() && peek() == '=';
 
-    if (negative) {
-      word = "-";
-    } else {
-      word = "";
+    OpKind op{};
+    switch (c) {
+      case '+':
+        op = OpKind::Add;
+        break;
+      case '-':
+        op = OpKind::Sub;
+        break;
+      case '*':
+        op = OpKind::Mul;
+        break;
+      case '/':
+        op = OpKind::Div;
+        break;
+      case '%':
+        op = OpKind::Mod;
+        break;
+      case '<':
+        op = isEqualsNext ? OpKind::Lte : OpKind::Lt;
+        break;
+      case '>':
+        op = isEqualsNext ? OpKind::Gte : OpKind::Gt;
+        break;
+      case '=':
+        op = OpKind::Eq;
+        break;
+      default:
+        THROW("Unexpected op <%c> at pos %d", c, start);
     }
+    if (op == OpKind::Lte || op == OpKind::Gte || op == OpKind::Eq) next();
 
-    word += readWhile([](char c) -> bool { return isdigit(c) || c == '.'; });
-    return Lexeme(LexemeKind::Number, word);
+    Lexeme lexeme{LexemeKind::Op, code.substr(start, ptr - start)};
+    lexeme.op = op;
+    return lexeme;
   }
 
   Lexeme readString() {
     assert_or_throw(next() == '"', "Expected opening double quote");
-    string s = readWhile([](char c) -> bool { return c != '"'; });
+    string_view s = readWhile([](char c) -> bool { return c != '"'; });
     assert_or_throw(next() == '"', "Expected closing double quote");
     return Lexeme(LexemeKind::String, s);
   }
 
-  string readWhile(bool (*condFn)(char)) {
-    string out{};
-
-    while (!isEnd() && condFn(peek())) {
-      out.push_back(next());
-    }
-
-    return out;
+  string_view readWhile(bool (*condFn)(char)) {
+    size_t start = ptr;
+    while (ptr < code.size() && condFn(code[ptr])) ptr++;
+    return code.substr(start, ptr - start);
   }
 
   bool isEnd() const {
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cmath>
+
+#include "raylib.h"
+#include "rlgl.h"
+#include "util.h"
+
+using namespace std;
+
+// Draws lines as quads with analytic, per pixel coverage - anti-aliased lines at native resolution without
+// supersampling.
+//
+// Every line is a butt capped quad of `thickness` width (the same geometry DrawLineEx uses), grown by a pixel on all
+// sides for the fading edge. The texture coordinates run from -1 to 1 across and along the grown quad, and the
+// fragment shader gets the pixel size of the quad back from their screen space derivatives, so no extra vertex
+// attributes or custom vertex shader are needed. Coverage is the box filtered distance to the quad's edges, like in
+// SoftRasterizer. Only GLSL 330 core and derivatives are used, which Mesa's software GL (llvmpipe) supports.
+struct LineShader {
+  Shader shader{};
+  bool isLoaded{false};
+  bool isAvailable{false};
+
+  // Needs a GL context, so it's loaded on first use.
+  bool load() {
+    if (isLoaded) return isAvailable;
+    isLoaded = true;
+
+    shader = LoadShaderFromMemory(nullptr, FRAGMENT_SHADER);
+    isAvailable = IsShaderReady(shader) && shader.id != rlGetShaderIdDefault();
+    if (!isAvailable) WARN("Line shader is not available, falling back to supersampled lines");
+
+    return isAvailable;
+  }
+
+  void unload() {
+    if (isAvailable) UnloadShader(shader);
+    isLoaded = isAvailable = false;
+  }
+
+  // The shader writes premultiplied colors: the target alpha stays opaque and the tiles can be drawn with the usual
+  // alpha blending.
+  void begin() const {
+    BeginShaderMode(shader);
+    BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+    rlDisableBackfaceCulling();
+    rlSetTexture(rlGetTextureIdDefault());
+  }
+
+  void end() const {
+    rlSetTexture(0);
+    rlEnableBackfaceCulling();
+    EndBlendMode();
+    EndShaderMode();
+  }
+
+  // Between begin() and end(), coordinates are in target pixels.
+  void drawLine(Vector2 from, Vector2 to, float thickness, Color color) const {
+    float dx = to.x - from.x;
+    float dy = to.y - from.y;
+    float length = sqrtf(dx * dx + dy * dy);
+    if (length <= 0.f || thickness <= 0.f) return;
+
+    float dirx = dx / length;
+    float diry = dy / length;
+    float halfLength = length / 2.f + 1.f;
+    float halfWidth = thickness / 2.f + 1.f;
+
+    float cx = (from.x + to.x) / 2.f;
+    float cy = (from.y + to.y) / 2.f;
+    float ux = dirx * halfLength;
+    float uy = diry * halfLength;
+    float vx = -diry * halfWidth;
+    float vy = dirx * halfWidth;
+
+    // Flushes the batch when it's full, which is only safe outside of rlBegin / rlEnd.
+    rlCheckRenderBatchLimit(4);
+
+    rlBegin(RL_QUADS);
+    rlColor4ub(color.r, color.g, color.b, color.a);
+    rlTexCoord2f(-1.f, -1.f);
+    rlVertex2f(cx - ux - vx, cy - uy - vy);
+    rlTexCoord2f(-1.f, 1.f);
+    rlVertex2f(cx - ux + vx, cy - uy + vy);
+    rlTexCoord2f(1.f, 1.f);
+    rlVertex2f(cx + ux + vx, cy + uy + vy);
+    rlTexCoord2f(1.f, -1.f);
+    rlVertex2f(cx + ux - vx, cy + uy - vy);
+    rlEnd();
+  }
+
+ private:
+  // `fragTexCoord` is (along, across) in -1..1 over the grown quad. 1 / |gradient| is the half extent in pixels.
+  static constexpr const char *FRAGMENT_SHADER = R"(#version 330
+in vec2 fragTexCoord;
+in vec4 fragColor;
+out vec4 finalColor;
+
+float edgeCoverage(float s) {
+  float halfExtent = 1.0 / length(vec2(dFdx(s), dFdy(s)));
+  return halfExtent - 0.5 - abs(s) * halfExtent;
+}
+
+void main() {
+  float halfWidth = 1.0 / length(vec2(dFdx(fragTexCoord.y), dFdy(fragTexCoord.y))) - 1.0;
+  float across = clamp(edgeCoverage(fragTexCoord.y), 0.0, min(1.0, halfWidth * 2.0));
+  float along = clamp(edgeCoverage(fragTexCoord.x), 0.0, 1.0);
+  float a = across * along * fragColor.a;
+  finalColor = vec4(fragColor.rgb * a, a);
+}
+)";
+};
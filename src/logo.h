@@ -1,25 +1,101 @@
 #pragma once
 
+#include <chrono>
+#include <optional>
+#include <string_view>
+
 #include "ast.h"
 #include "lexer.h"
 #include "parser.h"
+#include "trace.h"
 #include "vm.h"
 
-void runLogo(const char *code, VM *vm, float *renderTime) {
-  TraceLog(LOG_INFO, "Compile start");
-  double t_start = GetTime();
+struct RunTimes {
+  // Lexing included, the parser pulls the lexemes.
+  float parse{};
+  float execute{};
+
+  float total() const {
+    return parse + execute;
+  }
+};
 
+// Not GetTime(), that needs a window.
+float secondsSince(chrono::steady_clock::time_point t_start) {
+  return chrono::duration<float>(chrono::steady_clock::now() - t_start).count();
+}
+
+void reportLogoError(runtime_error &e) {
+  WARN("Compile error: %s", e.what());
+  appLog.append(TextFormat("[ERROR] compile error: %s", e.what()));
+}
+
+// Lexes and parses `code`, the program can be executed any number of times.
+optional<Ast::Program> compileLogo(string_view code, RunTimes *times) {
   try {
+    auto t_start = chrono::steady_clock::now();
+    TRACE_SCOPE("parse");
     Lexer lexer{code};
-    Parser parser{lexer.parse()};
+    Parser parser{lexer};
     Ast::Program prg = parser.parse();
-    prg.execute(vm);
+    times->parse = secondsSince(t_start);
+
+    return prg;
   } catch (runtime_error &e) {
-    WARN("Compile error: %s", e.what());
-    appLog.append(TextFormat("[ERROR] compile error: %s", e.what()));
+    reportLogoError(e);
+    return nullopt;
   }
+}
+
+// Parses an edit of the source of `old` incrementally (see reparse()), nullopt if it has to be compiled again. Parse
+// errors are left to that compile to report.
+optional<Reparse> reparseLogo(Ast::Program const &old, string_view oldCode, string_view code, RunTimes *times) {
+  auto t_start = chrono::steady_clock::now();
+  TRACE_SCOPE("reparse");
+  optional<Reparse> result = reparse(old, oldCode, code);
+  times->parse = secondsSince(t_start);
+  return result;
+}
+
+// With `resumeFrom` the program is executed from that top-level statement on with checkpoints.
+bool executeLogo(Ast::Program &prg, VM *vm, RunTimes *times, optional<size_t> resumeFrom = nullopt) {
+  TRACE_SCOPE("execute");
+  auto t_start = chrono::steady_clock::now();
+  bool isOk{true};
+
+  if (vm->profiler.isEnabled) {
+    vm->profiler.clear();
+    vm->profiler.firstStatement = resumeFrom.value_or(0);
+  }
+
+  try {
+    if (resumeFrom.has_value()) {
+      prg.executeFrom(vm, resumeFrom.value());
+    } else {
+      prg.execute(vm);
+    }
+  } catch (runtime_error &e) {
+    reportLogoError(e);
+    isOk = false;
+  } catch (LineBudgetReached &) {
+    // A draft, the drawing so far is what was asked for.
+  }
+
+  if (vm->profiler.isEnabled) vm->profiler.leaveAll(vm->history.size());
+
+  times->execute = secondsSince(t_start);
+  return isOk;
+}
+
+bool runLogo(string_view code, VM *vm, RunTimes *times) {
+  TRACE_SCOPE("runLogo");
+  TraceLog(LOG_INFO, "Compile start");
+
+  *times = RunTimes{};
+  auto prg = compileLogo(code, times);
+  bool isOk = prg.has_value() && executeLogo(prg.value(), vm, times);
 
-  *renderTime = GetTime() - t_start;
+  TraceLog(LOG_INFO, "Compile end. Latency: %.2f ms", times->total() * 1000.0);
 
-  TraceLog(LOG_INFO, "Compile end. Latency: %.2f ms", *renderTime * 1000.0);
+  return isOk;
 }
@@ -1,9 +1,12 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 
 #include "app.h"
 #include "config.h"
+#include "headless.h"
+#include "sampler.h"
 
 using namespace std;
 
@@ -13,12 +16,36 @@ int main(int argc, char** args) {
   config.win_w = 1024;
   config.win_h = 768;
 
+  // `kill -USR1` samples the interpreter of any running plogo.
+  sampler.listen();
+
+  if (argc >= 2 && strcmp(args[1], "--headless") == 0) {
+    Headless headless{};
+    if (!headless.parseArgs(argc, args)) return EXIT_FAILURE;
+    int status = headless.run();
+    sampler.shutdown();
+    return status;
+  }
+
   App app;
   app.init();
 
-  if (argc >= 2) app.loadSourceFile(args[1]);
+  // plogo [--trace FILE] [--sample FILE] [SCRIPT]
+  char* sourceFileName{nullptr};
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(args[i], "--trace") == 0 && i + 1 < argc) {
+      app.tracePath = args[++i];
+    } else if (strcmp(args[i], "--sample") == 0 && i + 1 < argc) {
+      sampler.start(args[++i]);
+    } else {
+      sourceFileName = args[i];
+    }
+  }
+
+  if (sourceFileName != nullptr) app.loadSourceFile(sourceFileName);
 
   app.run();
+  sampler.shutdown();
 
   return EXIT_SUCCESS;
 }
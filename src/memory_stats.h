@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <string>
+
+using namespace std;
+
+// What the memory of the process is used for. Lexemes are the lexer's symbol tables (the parser pulls the lexemes
+// through a fixed ring), stack is the VM's value stack and call arguments, strings the text of string values and
+// checkpoints the VM states kept to resume programs from.
+enum class MemoryKind {
+  Ast,
+  Lexemes,
+  Frames,
+  History,
+  Stack,
+  Strings,
+  Checkpoints,
+  Textures,
+};
+
+constexpr int MEMORY_KIND_COUNT = 8;
+constexpr const char *MEMORY_KIND_NAMES[MEMORY_KIND_COUNT] = {"AST",     "lexemes", "frames",      "history",
+                                                              "stack",   "strings", "checkpoints", "textures"};
+
+struct MemoryCounter {
+  atomic<int64_t> live{0};
+  atomic<int64_t> peak{0};
+};
+
+// Live and peak bytes per kind, counted by the owners of the memory (TrackingAllocator, the AST arena, string values
+// and the tile textures). Counting is lock-free, the VM and parser run on any thread.
+struct MemoryStats {
+  array<MemoryCounter, MEMORY_KIND_COUNT> counters{};
+
+  void add(MemoryKind kind, size_t bytes) {
+    MemoryCounter &counter = counters[(int)kind];
+    int64_t live = counter.live.fetch_add((int64_t)bytes, memory_order_relaxed) + (int64_t)bytes;
+    int64_t peak = counter.peak.load(memory_order_relaxed);
+    while (live > peak && !counter.peak.compare_exchange_weak(peak, live, memory_order_relaxed)) {
+    }
+  }
+
+  void remove(MemoryKind kind, size_t bytes) {
+    counters[(int)kind].live.fetch_sub((int64_t)bytes, memory_order_relaxed);
+  }
+
+  int64_t live(MemoryKind kind) const {
+    return counters[(int)kind].live.load(memory_order_relaxed);
+  }
+  int64_t peak(MemoryKind kind) const {
+    return counters[(int)kind].peak.load(memory_order_relaxed);
+  }
+
+  int64_t totalLive() const {
+    int64_t total{0};
+    for (auto const &counter : counters) total += counter.live.load(memory_order_relaxed);
+    return total;
+  }
+
+  // One `kind live/peak` item per kind, in KB.
+  string summary() const {
+    string result{};
+    char item[64];
+    for (int i = 0; i < MEMORY_KIND_COUNT; i++) {
+      snprintf(item, sizeof(item), "%s%s %.0f/%.0f", i == 0 ? "" : ", ", MEMORY_KIND_NAMES[i],
+               live((MemoryKind)i) / 1e3, peak((MemoryKind)i) / 1e3);
+      result += item;
+    }
+    return result;
+  }
+};
+
+static MemoryStats memoryStats{};
+
+// Counts the memory of a standard container into `KIND`.
+template <typename T, MemoryKind KIND>
+struct TrackingAllocator {
+  using value_type = T;
+
+  TrackingAllocator() = default;
+  template <typename U>
+  TrackingAllocator(TrackingAllocator<U, KIND> const &) {
+  }
+
+  template <typename U>
+  struct rebind {
+    using other = TrackingAllocator<U, KIND>;
+  };
+
+  T *allocate(size_t n) {
+    memoryStats.add(KIND, n * sizeof(T));
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T *p, size_t n) {
+    memoryStats.remove(KIND, n * sizeof(T));
+    ::operator delete(p);
+  }
+
+  template <typename U>
+  bool operator==(TrackingAllocator<U, KIND> const &) const {
+    return true;
+  }
+};
+
+// A string whose heap buffer (once it outgrows the inline one) is counted into `KIND`.
+template <MemoryKind KIND>
+using TrackedString = basic_string<char, char_traits<char>, TrackingAllocator<char, KIND>>;
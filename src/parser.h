@@ -1,13 +1,19 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <exception>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "ast.h"
 
 using namespace std;
 
-void assert_lexeme(Lexeme lexeme, LexemeKind kind, string v) {
+void assert_lexeme(Lexeme const &lexeme, LexemeKind kind, string_view v) {
   char msgbuf[128];
 
   if (lexeme.kind != kind) {
@@ -17,34 +23,69 @@ void assert_lexeme(Lexeme lexeme, LexemeKind kind, string v) {
   }
 
   if (lexeme.v != v) {
-    snprintf(msgbuf, 128, "Lexeme mismatch. Expected value: %s but got: %s", v.c_str(), lexeme.v.c_str());
+    snprintf(msgbuf, 128, "Lexeme mismatch. Expected value: %.*s but got: %.*s", (int)v.size(), v.data(),
+             (int)lexeme.v.size(), lexeme.v.data());
     throw runtime_error(msgbuf);
   }
 }
 
+// Pulls the lexemes from the lexer while parsing, through a ring of the few it looks ahead. No token vector is built,
+// so the memory used besides the AST does not grow with the source.
 struct Parser {
-  vector<Lexeme> lexemes;
-  size_t ptr = 0;
-
-  Parser(vector<Lexeme> lexemes) : lexemes(lexemes) {
+  // peek(n) looks at most this many lexemes ahead.
+  static constexpr size_t LOOKAHEAD = 2;
+
+  Lexer &lexer;
+  array<Lexeme, LOOKAHEAD> ring{};
+  // Ring index of the next lexeme, and how many are pulled.
+  size_t head = 0;
+  size_t count = 0;
+  bool isLexerDone = false;
+  // The program's nodes and names.
+  shared_ptr<Ast::AstStorage> storage{make_shared<Ast::AstStorage>()};
+  // By lexer symbol, null until the name is used.
+  vector<string const *> symbolNames{};
+  // Shared by the nested statement lists, calls and expressions, so parsing them does not allocate these.
+  vector<Ast::Node *> statementStack{};
+  vector<Ast::Expr *> exprStack{};
+  vector<OpKind> opStack{};
+  // Lexer offsets of the top-level statements.
+  vector<size_t> statementStarts{};
+  // First lines of the top-level statements, the last one is the statement being parsed.
+  vector<uint32_t *> statementLines{};
+  // Line of the lexer offset `linePos`, lines are counted forward as the calls are parsed.
+  uint32_t line = 1;
+  size_t linePos = 0;
+
+  Parser(Lexer &lexer) : lexer(lexer) {
+  }
+  // Adds the nodes to an existing program's storage, see reparse().
+  Parser(Lexer &lexer, shared_ptr<Ast::AstStorage> storage) : lexer(lexer), storage(std::move(storage)) {
   }
 
+  // Builds the program in the parser's storage, once per parser.
   Ast::Program parse() {
-    vector<unique_ptr<Ast::Node>> statements;
-
-    while (!isEnd()) {
-      statements.push_back(parse_statement());
-    }
+    Ast::NodeList statements = parse_top_level();
+    return Ast::Program(std::move(storage), statements, std::move(statementStarts), std::move(statementLines),
+                        lexer.code.size());
+  }
 
-    return Ast::Program(std::move(statements));
+  // The top-level statements, noting where each of them starts.
+  Ast::NodeList parse_top_level() {
+    return parse_statements([this]() -> bool {
+      if (isEnd()) return true;
+      statementStarts.push_back(peek().pos);
+      statementLines.push_back(storage->arena.make<uint32_t>(lineOf(peek().pos)));
+      return false;
+    });
   }
 
-  unique_ptr<Ast::Node> parse_statement() {
-    if (peek().kind == LexemeKind::Keyword && peek().v == "loop") {
+  Ast::Node *parse_statement() {
+    if (peek().isKeyword(KeywordKind::Loop)) {
       return parse_loop();
-    } else if (peek().kind == LexemeKind::Keyword && peek().v == "fn") {
+    } else if (peek().isKeyword(KeywordKind::Fn)) {
       return parse_fndef();
-    } else if (peek().kind == LexemeKind::Keyword && peek().v == "if") {
+    } else if (peek().isKeyword(KeywordKind::If)) {
       return parse_if();
     } else if (peek().kind == LexemeKind::Name && (!isEnd(1) && peek(1).kind == LexemeKind::Assignment)) {
       return parse_assign();
@@ -53,58 +94,67 @@ struct Parser {
     }
   }
 
-  unique_ptr<Ast::AssignmentNode> parse_assign() {
+  // Statements until `isLast()`, the nested blocks share the stack of them.
+  template <typename IsLast>
+  Ast::NodeList parse_statements(IsLast isLast) {
+    size_t base = statementStack.size();
+    while (!isLast()) {
+      Ast::Node *statement = parse_statement();
+      statementStack.push_back(statement);
+    }
+
+    Ast::NodeList statements = storage->arena.makeList(statementStack.data() + base, statementStack.size() - base);
+    statementStack.resize(base);
+    return statements;
+  }
+
+  // Statements in braces.
+  Ast::NodeList parse_block() {
+    assert_lexeme(next(), LexemeKind::BraceOpen, "");
+    Ast::NodeList statements = parse_statements([this]() -> bool { return peek().kind == LexemeKind::BraceClose; });
+    assert_lexeme(next(), LexemeKind::BraceClose, "");
+    return statements;
+  }
+
+  Ast::AssignmentNode *parse_assign() {
     auto lval = parse_expr_name();
     assert_lexeme(next(), LexemeKind::Assignment, "");
     auto rval = parse_expr();
 
-    return make_unique<Ast::AssignmentNode>(std::move(lval), std::move(rval));
+    return storage->arena.make<Ast::AssignmentNode>(lval, rval);
   }
 
-  unique_ptr<Ast::IfNode> parse_if() {
+  Ast::IfNode *parse_if() {
     assert_lexeme(next(), LexemeKind::Keyword, "if");
     assert_lexeme(next(), LexemeKind::ParenOpen, "");
 
-    unique_ptr<Ast::Expr> condExpr = parse_expr();
+    Ast::Expr *condExpr = parse_expr();
 
     assert_lexeme(next(), LexemeKind::ParenClose, "");
-    assert_lexeme(next(), LexemeKind::BraceOpen, "");
 
-    vector<unique_ptr<Ast::Node>> trueStatements{};
-    while (peek().kind != LexemeKind::BraceClose) {
-      trueStatements.push_back(parse_statement());
-    }
-
-    assert_lexeme(next(), LexemeKind::BraceClose, "");
+    Ast::NodeList trueStatements = parse_block();
 
-    vector<unique_ptr<Ast::Node>> falseStatements{};
-    if (!isEnd() && peek().kind == LexemeKind::Keyword && peek().v == "else") {
+    Ast::NodeList falseStatements{};
+    if (!isEnd() && peek().isKeyword(KeywordKind::Else)) {
       assert_lexeme(next(), LexemeKind::Keyword, "else");
-      assert_lexeme(next(), LexemeKind::BraceOpen, "");
-
-      while (peek().kind != LexemeKind::BraceClose) {
-        falseStatements.push_back(parse_statement());
-      }
-
-      assert_lexeme(next(), LexemeKind::BraceClose, "");
+      falseStatements = parse_block();
     }
 
-    return make_unique<Ast::IfNode>(std::move(condExpr), std::move(trueStatements), std::move(falseStatements));
+    return storage->arena.make<Ast::IfNode>(condExpr, trueStatements, falseStatements);
   }
 
-  unique_ptr<Ast::FnDefNode> parse_fndef() {
+  Ast::FnDefNode *parse_fndef() {
     assert_lexeme(next(), LexemeKind::Keyword, "fn");
 
-    Lexeme nameToken = next();
-    assert_lexeme(nameToken.kind, LexemeKind::Name, "");
+    string const *name = internName(next(LexemeKind::Name));
 
     assert_lexeme(next(), LexemeKind::ParenOpen, "");
 
-    vector<string> argNames{};
+    vector<string const *> argNames{};
     while (true) {
       if (peek().kind == LexemeKind::ParenClose) break;
 
-      argNames.push_back(next().v);
+      argNames.push_back(internName(next(LexemeKind::Name)));
 
       if (peek().kind != LexemeKind::Comma) break;
 
@@ -112,47 +162,40 @@ struct Parser {
     }
 
     assert_lexeme(next(), LexemeKind::ParenClose, "");
-    assert_lexeme(next(), LexemeKind::BraceOpen, "");
 
-    vector<unique_ptr<Ast::Node>> statements;
-    while (peek().kind != LexemeKind::BraceClose) {
-      statements.push_back(parse_statement());
-    }
-
-    assert_lexeme(next(), LexemeKind::BraceClose, "");
+    Ast::NodeList statements = parse_block();
 
-    return make_unique<Ast::FnDefNode>(nameToken.v, argNames, std::move(statements));
+    auto fn = storage->arena.make<Ast::ExecutableFnNode>(storage->arena.makeList(argNames.data(), argNames.size()),
+                                                         statements);
+    return storage->arena.make<Ast::FnDefNode>(name, fn);
   }
 
-  unique_ptr<Ast::LoopNode> parse_loop() {
+  Ast::LoopNode *parse_loop() {
     assert_lexeme(next(), LexemeKind::Keyword, "loop");
     assert_lexeme(next(), LexemeKind::ParenOpen, "");
 
-    unique_ptr<Ast::Expr> count = parse_expr();
+    Ast::Expr *count = parse_expr();
 
     assert_lexeme(next(), LexemeKind::ParenClose, "");
-    assert_lexeme(next(), LexemeKind::BraceOpen, "");
 
-    vector<unique_ptr<Ast::Node>> statements{};
-    while (peek().kind != LexemeKind::BraceClose) {
-      statements.push_back(parse_statement());
-    }
-
-    assert_lexeme(next(), LexemeKind::BraceClose, "");
+    Ast::NodeList statements = parse_block();
 
-    return make_unique<Ast::LoopNode>(std::move(count), std::move(statements));
+    return storage->arena.make<Ast::LoopNode>(count, statements);
   }
 
-  unique_ptr<Ast::FnCallNode> parse_fncall() {
-    Lexeme nameToken = next();
-    assert_lexeme(nameToken.kind, LexemeKind::Name, "");
+  Ast::FnCallNode *parse_fncall() {
+    Lexeme const &nameLexeme = next(LexemeKind::Name);
+    uint32_t callLine = lineOf(nameLexeme.pos);
+    string const *name = internName(nameLexeme);
     assert_lexeme(next(), LexemeKind::ParenOpen, "");
 
-    vector<unique_ptr<Ast::Expr>> args{};
+    // The arguments go on the expression stack above the operands of the enclosing expressions.
+    size_t base = exprStack.size();
     while (true) {
       if (peek().kind == LexemeKind::ParenClose) break;
 
-      args.push_back(parse_expr());
+      Ast::Expr *arg = parse_expr();
+      exprStack.push_back(arg);
 
       if (peek().kind != LexemeKind::Comma) break;
       next();
@@ -160,101 +203,263 @@ struct Parser {
 
     assert_lexeme(next(), LexemeKind::ParenClose, "");
 
-    return make_unique<Ast::FnCallNode>(nameToken.v, std::move(args));
+    Ast::ExprList args = storage->arena.makeList(exprStack.data() + base, exprStack.size() - base);
+    exprStack.resize(base);
+    uint32_t const *statementLine = statementLines.back();
+    return storage->arena.make<Ast::FnCallNode>(name, args, statementLine, callLine - *statementLine);
   }
 
-  unique_ptr<Ast::Expr> parse_expr() {
-    vector<unique_ptr<Ast::Expr>> exprList{};
-    vector<string> ops{};
+  Ast::Expr *parse_expr() {
+    // The operands and operators of the enclosing expressions stay below these.
+    size_t exprBase = exprStack.size();
+    size_t opBase = opStack.size();
 
     while (true) {
+      Ast::Expr *operand{};
       if (peek().kind == LexemeKind::Number) {
-        exprList.push_back(parse_expr_number());
+        operand = parse_expr_number();
       } else if (peek().kind == LexemeKind::Name) {
         if (!isEnd(1) && peek(1).kind == LexemeKind::ParenOpen) {
-          exprList.push_back(parse_fncall());
+          operand = parse_fncall();
         } else {
-          exprList.push_back(parse_expr_name());
+          operand = parse_expr_name();
         }
       } else if (peek().kind == LexemeKind::String) {
-        exprList.push_back(parse_expr_string());
+        operand = parse_expr_string();
       } else if (peek().kind == LexemeKind::ParenOpen) {
         next();
-        exprList.push_back(parse_expr());
+        operand = parse_expr();
         if (peek().kind != LexemeKind::ParenClose) throw runtime_error("Paren expression is missing closing paren");
         next();
       } else {
         throw runtime_error("Unexpected lexeme kind for expression");
       }
+      exprStack.push_back(operand);
 
       if (isEnd() || peek().kind != LexemeKind::Op) break;
 
-      string nextOp = next().v;
-      while (!ops.empty() && precedence(ops.back()) < precedence(nextOp)) {
-        reduceBinOps(exprList, ops);
+      OpKind nextOp = next().op;
+      while (opStack.size() > opBase && precedence(opStack.back()) < precedence(nextOp)) {
+        reduceBinOp();
       }
 
-      ops.push_back(nextOp);
+      opStack.push_back(nextOp);
     }
 
-    assert_or_throw(exprList.size() == ops.size() + 1, "Operator and operand counts does not align");
+    assert_or_throw(exprStack.size() - exprBase == opStack.size() - opBase + 1,
+                    "Operator and operand counts does not align");
 
-    while (!ops.empty()) {
-      reduceBinOps(exprList, ops);
+    while (opStack.size() > opBase) {
+      reduceBinOp();
     }
 
-    assert_or_throw(exprList.size() == 1, "Expected 1 operand to stay");
-    return std::move(exprList.back());
+    Ast::Expr *expr = exprStack.back();
+    exprStack.pop_back();
+    return expr;
   }
 
-  void reduceBinOps(vector<unique_ptr<Ast::Expr>> &exprList, vector<string> &ops) {
-    auto rhs = std::move(exprList.back());
-    exprList.pop_back();
-    auto lhs = std::move(exprList.back());
-    exprList.pop_back();
+  void reduceBinOp() {
+    Ast::Expr *rhs = exprStack.back();
+    exprStack.pop_back();
+    Ast::Expr *lhs = exprStack.back();
+    exprStack.pop_back();
 
-    unique_ptr<Ast::Expr> newExpr = make_unique<Ast::BinOpExpr>(ops.back(), std::move(lhs), std::move(rhs));
-    ops.pop_back();
-    exprList.push_back(std::move(newExpr));
+    exprStack.push_back(storage->arena.make<Ast::BinOpExpr>(opStack.back(), lhs, rhs));
+    opStack.pop_back();
   }
 
-  unique_ptr<Ast::FloatExpr> parse_expr_number() {
-    Lexeme val = next();
-    assert_lexeme(val.kind, LexemeKind::Number, "");
-    return make_unique<Ast::FloatExpr>(stof(val.v));
+  Ast::FloatExpr *parse_expr_number() {
+    return storage->arena.make<Ast::FloatExpr>(next(LexemeKind::Number).number);
   }
 
-  unique_ptr<Ast::NameExpr> parse_expr_name() {
-    Lexeme val = next();
-    assert_lexeme(val.kind, LexemeKind::Name, "");
-    return make_unique<Ast::NameExpr>(val.v);
+  Ast::NameExpr *parse_expr_name() {
+    return storage->arena.make<Ast::NameExpr>(internName(next(LexemeKind::Name)));
   }
 
-  unique_ptr<Ast::StringExpr> parse_expr_string() {
-    Lexeme val = next();
-    assert_lexeme(val.kind, LexemeKind::String, "");
-    return make_unique<Ast::StringExpr>(val.v);
+  Ast::StringExpr *parse_expr_string() {
+    return storage->arena.make<Ast::StringExpr>(&storage->names.emplace_back(next(LexemeKind::String).v));
   }
 
-  bool isEnd() const {
-    return ptr >= lexemes.size();
+  // The name of a name lexeme, stored once per program.
+  string const *internName(Lexeme const &lexeme) {
+    if (lexeme.symbol >= symbolNames.size()) symbolNames.resize(lexeme.symbol + 1, nullptr);
+    string const *&name = symbolNames[lexeme.symbol];
+    if (name == nullptr) name = &storage->names.emplace_back(lexeme.v);
+    return name;
   }
-  bool isEnd(int n) const {
-    return ptr + n >= lexemes.size();
+
+  // Source line of a lexer offset at or after the last one asked.
+  uint32_t lineOf(size_t pos) {
+    line += std::count(lexer.code.begin() + linePos, lexer.code.begin() + pos, '\n');
+    linePos = pos;
+    return line;
+  }
+
+  // Pulls lexemes until the one n ahead is in the ring, false if the source ends before.
+  bool pull(size_t n) {
+    while (count <= n) {
+      if (isLexerDone || !lexer.nextLexeme(ring[(head + count) % LOOKAHEAD])) {
+        isLexerDone = true;
+        return false;
+      }
+      count++;
+    }
+    return true;
+  }
+
+  bool isEnd() {
+    return !pull(0);
   }
-  Lexeme peek() const {
+  bool isEnd(int n) {
+    assert_or_throw(n < (int)LOOKAHEAD, "Parser looks further ahead than its ring");
+    return !pull(n);
+  }
+  // The returned lexemes are only valid until the next lexeme is pulled.
+  Lexeme const &peek() {
     if (isEnd()) throw runtime_error("EOF when peeking lexeme");
 
-    return lexemes.at(ptr);
+    return ring[head];
   }
-  Lexeme peek(int n) const {
+  Lexeme const &peek(int n) {
     if (isEnd(n)) throw runtime_error("EOF when peeking lexeme");
 
-    return lexemes.at(ptr + n);
+    return ring[(head + n) % LOOKAHEAD];
   }
-  Lexeme next() {
+  Lexeme const &next() {
     if (isEnd()) throw runtime_error("EOF when asking next lexeme");
 
-    return lexemes.at(ptr++);
+    Lexeme const &lexeme = ring[head];
+    head = (head + 1) % LOOKAHEAD;
+    count--;
+    return lexeme;
+  }
+  Lexeme const &next(LexemeKind kind) {
+    Lexeme const &lexeme = next();
+    if (lexeme.kind != kind) {
+      THROW("Lexeme mismatch. Expected kind %d but got: %d", static_cast<int>(kind), static_cast<int>(lexeme.kind));
+    }
+    return lexeme;
   }
 };
+
+struct Reparse {
+  Ast::Program program;
+  // Top-level statements before this one are the nodes of the old program.
+  size_t firstChanged;
+  // A function definition was added, removed or changed, at the top level or nested in a statement.
+  bool didFunctionsChange;
+};
+
+// `code` without trailing whitespace, two statements with this same text parse to the same nodes.
+string_view trimStatementText(string_view code) {
+  size_t end = code.find_last_not_of(" \t\r\n");
+  return code.substr(0, end == string_view::npos ? 0 : end + 1);
+}
+
+// Parses `code`, an edit of the source `oldCode` of `old`, by re-parsing only the top-level statements whose text
+// changed: the statements overlapping the edited range are parsed again into the old program's storage, and those
+// of them with the same text as an old statement keep the old node (and so the functions it defines and what the VM
+// learned about them). Kept statements are moved to their new lines in place (see Ast::FnCallNode::line), the old
+// program's lines are stale afterwards. Nullopt if the program has to be compiled from scratch: the edit can change
+// how the source after it is lexed, the edited statements do not parse, or the storage grew larger than a full compile
+// would be.
+optional<Reparse> reparse(Ast::Program const &old, string_view oldCode, string_view code) {
+  vector<size_t> const &oldStarts = old.statementStarts;
+  size_t n = oldStarts.size();
+  if (oldCode.size() != old.sourceSize || n != old.statements.size()) return nullopt;
+
+  // The edit replaced oldCode[prefix, oldCode.size() - suffix) with code[prefix, code.size() - suffix).
+  auto [prefixEnd, _] = mismatch(oldCode.begin(), oldCode.end(), code.begin(), code.end());
+  size_t prefix = prefixEnd - oldCode.begin();
+  size_t maxSuffix = min(oldCode.size(), code.size()) - prefix;
+  size_t suffix = 0;
+  while (suffix < maxSuffix && oldCode[oldCode.size() - 1 - suffix] == code[code.size() - 1 - suffix]) suffix++;
+  size_t oldEditEnd = oldCode.size() - suffix;
+
+  // The statements [first, last) overlap the edit, with the one before it: the edit may extend that.
+  size_t first = lower_bound(oldStarts.begin(), oldStarts.end(), prefix) - oldStarts.begin();
+  if (first > 0) first--;
+  size_t last = upper_bound(oldStarts.begin(), oldStarts.end(), oldEditEnd) - oldStarts.begin();
+
+  // The first statement's fragment also takes the whitespace and comments before it.
+  size_t fragmentStart = first > 0 ? oldStarts[first] : 0;
+  size_t oldFragmentEnd = last < n ? oldStarts[last] : oldCode.size();
+  size_t fragmentEnd = oldFragmentEnd + code.size() - oldCode.size();
+  string_view fragment = code.substr(fragmentStart, fragmentEnd - fragmentStart);
+
+  // A full parse lexes the statements after the fragment the same only if no token or comment of the fragment runs
+  // into them.
+  if (last < n && !fragment.empty()) {
+    char end = fragment.back();
+    if (!isspace(end) && end != ')' && end != '}') return nullopt;
+    size_t lastLine = fragment.find_last_of('\n');
+    if (fragment.find('#', lastLine == string_view::npos ? 0 : lastLine) != string_view::npos) return nullopt;
+  }
+
+  // Re-parsed statements are not freed until the program is compiled again.
+  shared_ptr<Ast::AstStorage> storage = old.storage;
+  storage->reparsedSize += fragment.size();
+  if (storage->reparsedSize > code.size()) return nullopt;
+
+  Ast::NodeList fragmentStatements{};
+  vector<size_t> fragmentStarts{};
+  vector<uint32_t *> fragmentLines{};
+  try {
+    Lexer lexer{fragment};
+    Parser parser{lexer, storage};
+    parser.line += std::count(code.begin(), code.begin() + fragmentStart, '\n');
+    fragmentStatements = parser.parse_top_level();
+    fragmentStarts = std::move(parser.statementStarts);
+    fragmentLines = std::move(parser.statementLines);
+  } catch (runtime_error &) {
+    return nullopt;
+  }
+
+  unordered_map<string_view, size_t> oldByText{};
+  for (size_t i = first; i < last; i++) oldByText.try_emplace(trimStatementText(old.statementText(oldCode, i)), i);
+
+  vector<Ast::Node *> statements{old.statements.begin(), old.statements.begin() + first};
+  vector<size_t> starts{oldStarts.begin(), oldStarts.begin() + first};
+  vector<uint32_t *> lines{old.statementLines.begin(), old.statementLines.begin() + first};
+  vector<bool> isOldReused(last - first, false);
+  bool didFunctionsChange{false};
+  for (size_t i = 0; i < fragmentStatements.size(); i++) {
+    size_t start = fragmentStarts[i];
+    size_t end = i + 1 < fragmentStarts.size() ? fragmentStarts[i + 1] : fragment.size();
+    auto it = oldByText.find(trimStatementText(fragment.substr(start, end - start)));
+
+    if (it == oldByText.end()) {
+      statements.push_back(fragmentStatements[i]);
+      lines.push_back(fragmentLines[i]);
+      didFunctionsChange |= Ast::definesFunction(*fragmentStatements[i]);
+    } else {
+      statements.push_back(old.statements[it->second]);
+      lines.push_back(old.statementLines[it->second]);
+      *lines.back() = *fragmentLines[i];
+      isOldReused[it->second - first] = true;
+      oldByText.erase(it);
+    }
+    starts.push_back(fragmentStart + start);
+  }
+  for (size_t i = first; i < last; i++) {
+    didFunctionsChange |= !isOldReused[i - first] && Ast::definesFunction(*old.statements[i]);
+  }
+  // The statements after the fragment moved by the lines the edit added or removed.
+  int64_t lineShift = std::count(code.begin() + prefix, code.end() - suffix, '\n') -
+                      std::count(oldCode.begin() + prefix, oldCode.begin() + oldEditEnd, '\n');
+  for (size_t i = last; i < n; i++) {
+    statements.push_back(old.statements[i]);
+    starts.push_back(oldStarts[i] + code.size() - oldCode.size());
+    lines.push_back(old.statementLines[i]);
+    *lines.back() = (uint32_t)(*lines.back() + lineShift);
+  }
+
+  size_t firstChanged = first;
+  while (firstChanged < min(statements.size(), n) && statements[firstChanged] == old.statements[firstChanged]) {
+    firstChanged++;
+  }
+
+  Ast::NodeList list = storage->arena.makeList(statements.data(), statements.size());
+  return Reparse{Ast::Program(std::move(storage), list, std::move(starts), std::move(lines), code.size()), firstChanged,
+                 didFunctionsChange};
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+struct ProfileStats {
+  uint64_t calls{0};
+  // Seconds. Recursive calls count into the inclusive time and segments of their outermost call only.
+  double inclusive{0.0};
+  double exclusive{0.0};
+  uint64_t segments{0};
+  // Calls of this function currently running.
+  int depth{0};
+};
+
+struct ProfileRow {
+  string name;
+  bool isBuiltin;
+  ProfileStats stats;
+};
+
+// Opt-in per function profiler of the interpreter: call counts, inclusive / exclusive time and emitted segments of
+// every user function and builtin called. Calls are timed by Ast::FnCallNode, which only checks `isEnabled` when the
+// profiler is off.
+struct Profiler {
+  static constexpr int MAX_BUILTINS = 32;
+
+  bool isEnabled{false};
+  // The profiled run was resumed from this top-level statement, the calls of the statements before are missing.
+  size_t firstStatement{0};
+
+  void clear() {
+    builtins = {};
+    builtinNames = {};
+    functions.clear();
+    openCalls.clear();
+  }
+
+  ProfileStats &builtin(int idx, const char *name) {
+    builtinNames[idx] = name;
+    return builtins[idx];
+  }
+
+  ProfileStats &function(string const &name) {
+    return functions[name];
+  }
+
+  void enter(ProfileStats &stats, size_t historySize) {
+    stats.calls++;
+    stats.depth++;
+    openCalls.push_back(OpenCall{&stats, chrono::steady_clock::now(), 0.0, historySize});
+  }
+
+  void leave(size_t historySize) {
+    OpenCall call = openCalls.back();
+    openCalls.pop_back();
+
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - call.start).count();
+    ProfileStats &stats = *call.stats;
+    stats.exclusive += elapsed - call.childTime;
+    if (--stats.depth == 0) {
+      stats.inclusive += elapsed;
+      stats.segments += historySize - call.historyStart;
+    }
+
+    if (!openCalls.empty()) openCalls.back().childTime += elapsed;
+  }
+
+  // Closes the calls an error or the line budget left open.
+  void leaveAll(size_t historySize) {
+    while (!openCalls.empty()) leave(historySize);
+  }
+
+  // Everything called at least once, unsorted.
+  vector<ProfileRow> rows() const {
+    vector<ProfileRow> result{};
+    for (int i = 0; i < MAX_BUILTINS; i++) {
+      if (builtins[i].calls > 0) result.push_back(ProfileRow{builtinNames[i], true, builtins[i]});
+    }
+    for (auto const &[name, stats] : functions) result.push_back(ProfileRow{name, false, stats});
+    return result;
+  }
+
+  // A JSON array of the rows, times in milliseconds.
+  void writeJson(ostream &out) const {
+    out << "[";
+    bool isFirst{true};
+    for (auto const &row : rows()) {
+      out << (isFirst ? "\n" : ",\n") << "  {\"name\": ";
+      writeJsonString(out, row.name);
+      out << ", \"builtin\": " << (row.isBuiltin ? "true" : "false") << ", \"calls\": " << row.stats.calls
+          << ", \"inclusive_ms\": " << row.stats.inclusive * 1000.0
+          << ", \"exclusive_ms\": " << row.stats.exclusive * 1000.0 << ", \"segments\": " << row.stats.segments << "}";
+      isFirst = false;
+    }
+    out << (isFirst ? "]" : "\n]");
+  }
+
+  static void writeJsonString(ostream &out, string const &s) {
+    out << '"';
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        out << '\\' << c;
+      } else if ((unsigned char)c < 0x20) {
+        char escaped[8];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        out << escaped;
+      } else {
+        out << c;
+      }
+    }
+    out << '"';
+  }
+
+ private:
+  struct OpenCall {
+    ProfileStats *stats;
+    chrono::steady_clock::time_point start;
+    double childTime;
+    size_t historyStart;
+  };
+
+  array<ProfileStats, MAX_BUILTINS> builtins{};
+  array<const char *, MAX_BUILTINS> builtinNames{};
+  // Keyed by name, the function nodes change on every run.
+  unordered_map<string, ProfileStats> functions{};
+  vector<OpenCall> openCalls{};
+};
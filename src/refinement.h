@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+
+using namespace std;
+
+// Decides how detailed script runs are while the sliders are dragged. As long as a slider keeps moving, runs are
+// drafts: level of detail with a coarse threshold and a cap on the number of lines, so scrubbing heavy scripts stays
+// interactive. Once the slider is released or held still for IDLE_TIME, the draft is replaced by a full detail run.
+struct RefinementScheduler {
+  static constexpr double IDLE_TIME = 0.25;
+  static constexpr float DRAFT_LOD_THRESHOLD = 2.f;
+  static constexpr size_t DRAFT_LINE_BUDGET = 20000;
+
+  bool isEnabled{true};
+  // Whether the drawing is a draft that still needs a full detail run.
+  bool isDraftShown{false};
+
+  // Called every frame by the UI (times in seconds).
+  void updateSliders(bool isAnySliderActive, bool didAnySliderChange, double now) {
+    isSliderActive = isAnySliderActive;
+    if (didAnySliderChange) lastChangeTime = now;
+  }
+
+  // The next run should be a draft.
+  bool isDrafting(double now) const {
+    return isEnabled && isSliderActive && now - lastChangeTime < IDLE_TIME;
+  }
+
+  bool needsRefinement(double now) const {
+    return isDraftShown && !isDrafting(now);
+  }
+
+ private:
+  bool isSliderActive{false};
+  double lastChangeTime{-1e9};
+};
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "util.h"
+
+using namespace std;
+
+// A user function call being interpreted: the function called and the source line of the call.
+struct ShadowFrame {
+  // Points into the program's storage.
+  string const *name;
+  uint32_t line;
+};
+
+constexpr const char *DEFAULT_SAMPLE_PATH = "plogo_samples.folded";
+
+// Sampling profiler of the interpreted call stacks, written as folded stacks for flame graph tools
+// (`flamegraph.pl plogo_samples.folded > flame.svg`, speedscope): one `script;fn:line;fn:line;builtin:line COUNT` line
+// per distinct stack.
+//
+// The VM keeps its stack of user function calls (VM::shadowStack) at all times, a push and a pop per call. While
+// sampling, a timer thread marks a sample due every INTERVAL and the interpreter takes it at its next call
+// (Ast::FnCallNode::eval): the stack is only ever read by the thread that owns it, and its names are alive. Time spent
+// between calls is charged to the next one.
+//
+// Sampling can be toggled at any time without restarting the process: by SIGUSR1 (`kill -USR1 PID`, the samples are
+// written when it stops), by `--sample FILE` and by the app's Debug panel.
+struct Sampler {
+  static constexpr chrono::microseconds INTERVAL{1000};
+  // How often the timer thread looks for a SIGUSR1 while not sampling.
+  static constexpr chrono::milliseconds IDLE_INTERVAL{100};
+
+  atomic<bool> isSampleDue{false};
+  atomic<bool> isToggleRequested{false};
+
+  Sampler() = default;
+  Sampler(const Sampler &) = delete;
+  Sampler &operator=(const Sampler &) = delete;
+  ~Sampler() {
+    shutdown();
+  }
+
+  // Starts the timer thread and lets SIGUSR1 toggle sampling, once per process.
+  void listen() {
+    if (timerThread.joinable()) return;
+    signal(SIGUSR1, handleSampleSignal);
+    timerThread = thread{[this]() { runTimer(); }};
+  }
+
+  // Stops sampling (writing the samples) and the timer thread.
+  void shutdown() {
+    if (isSampling()) stop();
+    {
+      lock_guard<mutex> lock{timerMutex};
+      isShuttingDown = true;
+    }
+    timerWakeup.notify_all();
+    if (timerThread.joinable()) timerThread.join();
+  }
+
+  // Clears the samples, they are written to `path` when sampling stops.
+  void start(string const &path = DEFAULT_SAMPLE_PATH) {
+    {
+      lock_guard<mutex> lock{samplesMutex};
+      samples.clear();
+      totalSamples = 0;
+      outPath = path;
+    }
+    isSamplingEnabled.store(true, memory_order_relaxed);
+    timerWakeup.notify_all();
+    INFO("Sampling call stacks into %s", path.c_str());
+  }
+
+  bool stop() {
+    isSamplingEnabled.store(false, memory_order_relaxed);
+    isSampleDue.store(false, memory_order_relaxed);
+
+    string path = samplePath();
+    ofstream file{path};
+    writeFolded(file);
+    if (!file.good()) {
+      WARN("Cannot write samples: %s", path.c_str());
+      return false;
+    }
+    INFO("Wrote %lu call stack samples to %s", sampleCount(), path.c_str());
+    return true;
+  }
+
+  bool isSampling() const {
+    return isSamplingEnabled.load(memory_order_relaxed);
+  }
+
+  // The root frame of the next samples.
+  void setScript(string const &name) {
+    lock_guard<mutex> lock{samplesMutex};
+    script = name;
+  }
+
+  // Called by the interpreter when a sample is due, with its stack and the call it is about to make.
+  void sample(vector<ShadowFrame> const &stack, ShadowFrame const &call) {
+    isSampleDue.store(false, memory_order_relaxed);
+
+    lock_guard<mutex> lock{samplesMutex};
+    if (!isSampling()) return;
+
+    key.assign(script);
+    for (ShadowFrame const &frame : stack) appendFrame(frame);
+    appendFrame(call);
+
+    auto it = samples.find(key);
+    if (it == samples.end()) it = samples.emplace(key, 0).first;
+    it->second++;
+    totalSamples++;
+  }
+
+  uint64_t sampleCount() {
+    lock_guard<mutex> lock{samplesMutex};
+    return totalSamples;
+  }
+
+  string samplePath() {
+    lock_guard<mutex> lock{samplesMutex};
+    return outPath;
+  }
+
+  // Sorted by stack, so merged profiles diff well. Returns the number of distinct stacks.
+  size_t writeFolded(ostream &out) {
+    lock_guard<mutex> lock{samplesMutex};
+    vector<pair<string_view, uint64_t>> sorted{samples.begin(), samples.end()};
+    sort(sorted.begin(), sorted.end());
+    for (auto const &[stack, count] : sorted) out << stack << ' ' << count << '\n';
+    return sorted.size();
+  }
+
+ private:
+  atomic<bool> isSamplingEnabled{false};
+
+  mutex timerMutex{};
+  condition_variable timerWakeup{};
+  bool isShuttingDown{false};
+  thread timerThread{};
+
+  mutex samplesMutex{};
+  string script{"plogo"};
+  string outPath{DEFAULT_SAMPLE_PATH};
+  unordered_map<string, uint64_t> samples{};
+  uint64_t totalSamples{0};
+  // The stack being sampled, reused.
+  string key{};
+
+  static void handleSampleSignal(int);
+
+  void runTimer() {
+    unique_lock<mutex> lock{timerMutex};
+    while (!isShuttingDown) {
+      timerWakeup.wait_for(lock, isSampling() ? INTERVAL : chrono::microseconds{IDLE_INTERVAL});
+      if (isShuttingDown) break;
+
+      if (isToggleRequested.exchange(false)) {
+        lock.unlock();
+        if (isSampling()) {
+          stop();
+        } else {
+          start(samplePath());
+        }
+        lock.lock();
+      } else if (isSampling()) {
+        isSampleDue.store(true, memory_order_relaxed);
+      }
+    }
+  }
+
+  void appendFrame(ShadowFrame const &frame) {
+    key += ';';
+    key += *frame.name;
+    key += ':';
+    char line[16];
+    auto [end, _] = to_chars(line, line + sizeof(line), frame.line);
+    key.append(line, end);
+  }
+};
+
+static Sampler sampler{};
+
+// Only sets a lock-free flag, the timer thread does the work.
+void Sampler::handleSampleSignal(int) {
+  sampler.isToggleRequested.store(true, memory_order_relaxed);
+}
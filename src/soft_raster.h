@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "raylib.h"
+#include "trace.h"
+#include "util.h"
+#include "vm.h"
+
+using namespace std;
+
+// CPU rasterizer of VM::history into an RGBA buffer - it needs no window or GL context.
+//
+// Lines are rasterized with the same geometry DrawLineEx uses (a butt capped quad of `thickness` width) but with
+// analytic box filtered coverage instead of supersampling. The image is split into BIN_SIZE square bins, lines are
+// binned by their bounding box and bins are rasterized in parallel: every bin is owned by one thread, so lines keep
+// their drawing order without any locking. Within a bin the coverage and blending runs on 4 pixel wide SIMD lanes.
+struct SoftRasterizer {
+  static constexpr int BIN_SIZE = 64;
+  static constexpr int LANES = 4;
+
+  int threadCount{max(1, (int)thread::hardware_concurrency())};
+
+  float lastBinTime{};
+  float lastRasterTime{};
+
+  // Renders the world seen from `origin` (top left corner) at `scale` into `pixels` (width * height, row major).
+  void render(LineHistory const &history, Vector2 origin, float scale, int width, int height, Color background,
+              vector<Color> &pixels) {
+    TRACE_SCOPE("soft raster");
+    auto t_start = chrono::steady_clock::now();
+
+    pixels.assign((size_t)width * height, background);
+
+    int binCols = (width + BIN_SIZE - 1) / BIN_SIZE;
+    int binRows = (height + BIN_SIZE - 1) / BIN_SIZE;
+    int binCount = binCols * binRows;
+    if (binCount == 0) return;
+
+    // Lines in screen space, then binned with a counting sort (bin `i` owns binItems[binStart[i] .. binStart[i+1]]).
+    segments.resize(history.size());
+    binStart.assign(binCount + 1, 0);
+
+    for (size_t i = 0; i < history.size(); i++) {
+      segments[i] = toSegment(history[i], origin, scale);
+      forEachBin(segments[i], binCols, binRows, [&](int bin) { binStart[bin + 1]++; });
+    }
+
+    for (int i = 1; i <= binCount; i++) binStart[i] += binStart[i - 1];
+
+    binItems.resize(binStart.back());
+    binCursor.assign(binStart.begin(), binStart.end() - 1);
+    for (unsigned int i = 0; i < segments.size(); i++) {
+      forEachBin(segments[i], binCols, binRows, [&](int bin) { binItems[binCursor[bin]++] = i; });
+    }
+
+    auto t_binned = chrono::steady_clock::now();
+    lastBinTime = chrono::duration<float>(t_binned - t_start).count();
+
+    atomic<int> nextBin{0};
+    auto worker = [&]() {
+      TRACE_SCOPE("raster bins");
+      BinBuffer buffer{};
+      for (int bin = nextBin++; bin < binCount; bin = nextBin++) {
+        rasterizeBin(bin % binCols, bin / binCols, width, height, background, buffer, pixels);
+      }
+    };
+
+    int workerCount = min(threadCount, binCount);
+    vector<thread> workers{};
+    for (int i = 1; i < workerCount; i++) workers.emplace_back(worker);
+    worker();
+    for (auto &t : workers) t.join();
+
+    lastRasterTime = chrono::duration<float>(chrono::steady_clock::now() - t_binned).count();
+  }
+
+ private:
+  // Line in pixel space with everything the coverage kernel needs precomputed.
+  struct Segment {
+    float ax, ay;
+    float dirx, diry;  // Unit direction, (1, 0) for zero length lines.
+    float length;
+    float halfWidth;
+    float maxCoverage;  // Lines thinner than a pixel can't cover it fully.
+    float r, g, b, a;
+    float minx, miny, maxx, maxy;
+  };
+
+  // Color planes of a bin in linear float [0..1] so blending doesn't accumulate rounding errors.
+  struct BinBuffer {
+    alignas(16) float r[BIN_SIZE * BIN_SIZE];
+    alignas(16) float g[BIN_SIZE * BIN_SIZE];
+    alignas(16) float b[BIN_SIZE * BIN_SIZE];
+  };
+
+  vector<Segment> segments{};
+  vector<unsigned int> binStart{};
+  vector<unsigned int> binItems{};
+  vector<unsigned int> binCursor{};
+
+  static Segment toSegment(Line const &line, Vector2 origin, float scale) {
+    Segment s{};
+    s.ax = (line.from.x - origin.x) * scale;
+    s.ay = (line.from.y - origin.y) * scale;
+    float bx = (line.to.x - origin.x) * scale;
+    float by = (line.to.y - origin.y) * scale;
+
+    float dx = bx - s.ax;
+    float dy = by - s.ay;
+    s.length = sqrtf(dx * dx + dy * dy);
+    s.dirx = s.length > 0.f ? dx / s.length : 1.f;
+    s.diry = s.length > 0.f ? dy / s.length : 0.f;
+
+    // Thickness is in screen pixels, like with DrawLineEx on the GL path.
+    s.halfWidth = max(line.thickness, 0.f) / 2.f;
+    s.maxCoverage = min(1.f, s.halfWidth * 2.f);
+
+    s.r = line.color.r / 255.f;
+    s.g = line.color.g / 255.f;
+    s.b = line.color.b / 255.f;
+    s.a = line.color.a / 255.f;
+
+    // Coverage fades out within half a pixel outside of the quad.
+    float margin = s.halfWidth + 1.f;
+    s.minx = min(s.ax, bx) - margin;
+    s.miny = min(s.ay, by) - margin;
+    s.maxx = max(s.ax, bx) + margin;
+    s.maxy = max(s.ay, by) + margin;
+
+    return s;
+  }
+
+  template <typename F>
+  static void forEachBin(Segment const &s, int binCols, int binRows, F fn) {
+    if (s.length <= 0.f || s.a <= 0.f) return;
+
+    int x0 = max(0, (int)floorf(s.minx / BIN_SIZE));
+    int y0 = max(0, (int)floorf(s.miny / BIN_SIZE));
+    int x1 = min(binCols - 1, (int)floorf(s.maxx / BIN_SIZE));
+    int y1 = min(binRows - 1, (int)floorf(s.maxy / BIN_SIZE));
+
+    for (int y = y0; y <= y1; y++) {
+      for (int x = x0; x <= x1; x++) {
+        fn(y * binCols + x);
+      }
+    }
+  }
+
+  void rasterizeBin(int binX, int binY, int width, int height, Color background, BinBuffer &buffer,
+                    vector<Color> &pixels) const {
+    int bin = binY * ((width + BIN_SIZE - 1) / BIN_SIZE) + binX;
+    int px0 = binX * BIN_SIZE;
+    int py0 = binY * BIN_SIZE;
+    int binW = min(BIN_SIZE, width - px0);
+    int binH = min(BIN_SIZE, height - py0);
+
+    if (binStart[bin] == binStart[bin + 1]) return;
+
+    fill(buffer.r, buffer.r + BIN_SIZE * BIN_SIZE, background.r / 255.f);
+    fill(buffer.g, buffer.g + BIN_SIZE * BIN_SIZE, background.g / 255.f);
+    fill(buffer.b, buffer.b + BIN_SIZE * BIN_SIZE, background.b / 255.f);
+
+    for (unsigned int i = binStart[bin]; i < binStart[bin + 1]; i++) {
+      Segment const &s = segments[binItems[i]];
+
+      int y0 = max(0, (int)floorf(s.miny) - py0);
+      int y1 = min(binH - 1, (int)ceilf(s.maxy) - py0);
+      // Spans start on a lane boundary so they never run over the bin row.
+      int x0 = max(0, (int)floorf(s.minx) - px0) / LANES * LANES;
+      int x1 = min(binW - 1, (int)ceilf(s.maxx) - px0);
+
+      for (int y = y0; y <= y1; y++) {
+        blendSpan(s, buffer, y * BIN_SIZE, x0, x1, (float)(px0 + 0.5f), (float)(py0 + y) + 0.5f);
+      }
+    }
+
+    for (int y = 0; y < binH; y++) {
+      Color *row = pixels.data() + (size_t)(py0 + y) * width + px0;
+      for (int x = 0; x < binW; x++) {
+        int idx = y * BIN_SIZE + x;
+        row[x] = Color{toByte(buffer.r[idx]), toByte(buffer.g[idx]), toByte(buffer.b[idx]), background.a};
+      }
+    }
+  }
+
+  // Blends the coverage of `s` into the pixels [x0, x1] of a bin row. `centerX0` is the pixel center x of the first
+  // column of the bin and `centerY` is the pixel center y of the row.
+  static void blendSpan(Segment const &s, BinBuffer &buffer, int rowOffset, int x0, int x1, float centerX0,
+                        float centerY) {
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 laneOffsets = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+    const __m128 dirx = _mm_set1_ps(s.dirx);
+    const __m128 diry = _mm_set1_ps(s.diry);
+    const __m128 relY = _mm_set1_ps(centerY - s.ay);
+    const __m128 length = _mm_set1_ps(s.length);
+    const __m128 edge = _mm_set1_ps(s.halfWidth + 0.5f);
+    const __m128 maxCoverage = _mm_set1_ps(s.maxCoverage);
+    const __m128 alpha = _mm_set1_ps(s.a);
+    const __m128 cr = _mm_set1_ps(s.r);
+    const __m128 cg = _mm_set1_ps(s.g);
+    const __m128 cb = _mm_set1_ps(s.b);
+
+    for (int x = x0; x <= x1; x += LANES) {
+      __m128 relX = _mm_add_ps(_mm_set1_ps(centerX0 + x - s.ax), laneOffsets);
+
+      // Distance along (u) and across (v) the line.
+      __m128 u = _mm_add_ps(_mm_mul_ps(relX, dirx), _mm_mul_ps(relY, diry));
+      __m128 v = _mm_sub_ps(_mm_mul_ps(relY, dirx), _mm_mul_ps(relX, diry));
+
+      __m128 coverageAcross = _mm_sub_ps(edge, _mm_and_ps(v, absMask));
+      coverageAcross = _mm_min_ps(_mm_max_ps(coverageAcross, zero), maxCoverage);
+      __m128 coverageAlong = _mm_add_ps(_mm_min_ps(u, _mm_sub_ps(length, u)), half);
+      coverageAlong = _mm_min_ps(_mm_max_ps(coverageAlong, zero), _mm_set1_ps(1.f));
+
+      __m128 a = _mm_mul_ps(_mm_mul_ps(coverageAcross, coverageAlong), alpha);
+      if (_mm_movemask_ps(_mm_cmpgt_ps(a, zero)) == 0) continue;
+
+      float *r = buffer.r + rowOffset + x;
+      float *g = buffer.g + rowOffset + x;
+      float *b = buffer.b + rowOffset + x;
+      __m128 dr = _mm_load_ps(r);
+      __m128 dg = _mm_load_ps(g);
+      __m128 db = _mm_load_ps(b);
+      _mm_store_ps(r, _mm_add_ps(dr, _mm_mul_ps(_mm_sub_ps(cr, dr), a)));
+      _mm_store_ps(g, _mm_add_ps(dg, _mm_mul_ps(_mm_sub_ps(cg, dg), a)));
+      _mm_store_ps(b, _mm_add_ps(db, _mm_mul_ps(_mm_sub_ps(cb, db), a)));
+    }
+#else
+    float relY = centerY - s.ay;
+    for (int x = x0; x <= x1; x++) {
+      float relX = centerX0 + x - s.ax;
+      float u = relX * s.dirx + relY * s.diry;
+      float v = relY * s.dirx - relX * s.diry;
+
+      float coverageAcross = toRange(s.halfWidth + 0.5f - fabsf(v), 0.f, s.maxCoverage);
+      float coverageAlong = toRange(min(u, s.length - u) + 0.5f, 0.f, 1.f);
+      float a = coverageAcross * coverageAlong * s.a;
+      if (a <= 0.f) continue;
+
+      int idx = rowOffset + x;
+      buffer.r[idx] += (s.r - buffer.r[idx]) * a;
+      buffer.g[idx] += (s.g - buffer.g[idx]) * a;
+      buffer.b[idx] += (s.b - buffer.b[idx]) * a;
+    }
+#endif
+  }
+
+  static unsigned char toByte(float v) {
+    return (unsigned char)toRange((int)lroundf(v * 255.f), 0, 255);
+  }
+};
@@ -1,11 +1,27 @@
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <thread>
 #include <utility>
 
+#include "alloc_stats.h"
+#include "arena.h"
 #include "ast.h"
+#include "history_index.h"
 #include "lexer.h"
+#include "logo.h"
+#include "memory_stats.h"
 #include "parser.h"
+#include "refinement.h"
+#include "sampler.h"
+#include "soft_raster.h"
+#include "trace.h"
 #include "util.h"
 #include "value.h"
+#include "vector_export.h"
 #include "vm.h"
 
 #define FAIL(...) log_and_fail("\x1b[91mFAIL\x1b[0m", __FILE__, __LINE__, __VA_ARGS__)
@@ -40,16 +56,32 @@ void test_tokens(string code, vector<pair<LexemeKind, string>> expected) {
       FAIL("Lexeme kind mismatch %d != %d", expected[i].first, lexemes[i].kind);
     }
     if (expected[i].second != lexemes[i].v) {
-      FAIL("Lexeme value mismatch %s != %s", expected[i].second.c_str(), lexemes[i].v.c_str());
+      FAIL("Lexeme value mismatch %s != %s", expected[i].second.c_str(), string(lexemes[i].v).c_str());
     }
   }
 
   PASS("test_tokens: %s", code.c_str());
 }
 
+void test_lexeme_values() {
+  string code{"fn loop2(a) { a = -2.5 * a <= a a }"};
+  Lexer lexer{code};
+  auto lexemes = lexer.parse();
+
+  ASSERT(lexemes[0].isKeyword(KeywordKind::Fn), "fn is a keyword");
+  ASSERT(lexemes[1].kind == LexemeKind::Name, "a name starting with a keyword is a name");
+  ASSERT(lexemes[3].symbol == lexemes[6].symbol && lexemes[6].symbol == lexemes[13].symbol, "names are interned");
+  ASSERT(lexemes[1].symbol != lexemes[3].symbol, "different names are different symbols");
+  ASSERT(eqf(lexemes[8].number, -2.5f), "numbers are converted when lexing");
+  ASSERT(lexemes[9].op == OpKind::Mul && lexemes[11].op == OpKind::Lte, "ops are classified when lexing");
+  ASSERT(lexemes[11].v == "<=", "lexemes view the source");
+  ASSERT(precedence(OpKind::Mul) < precedence(OpKind::Sub) && precedence(OpKind::Sub) < precedence(OpKind::Eq),
+         "precedence");
+}
+
 void test_vm(string code, void (*testFn)(VM*)) {
   Lexer lexer{code};
-  Parser parser{lexer.parse()};
+  Parser parser{lexer};
   Ast::Program prg = parser.parse();
   VM vm{};
   prg.execute(&vm);
@@ -62,7 +94,7 @@ void test_vm_raise(string code) {
 
   try {
     Lexer lexer{code};
-    Parser parser{lexer.parse()};
+    Parser parser{lexer};
     Ast::Program prg = parser.parse();
     VM vm{};
     prg.execute(&vm);
@@ -103,6 +135,722 @@ void test_value() {
   PASS("Value with string works: %s %s", tvm.v.strVal, v.strVal);
 }
 
+void test_history_index() {
+  VM vm{};
+  vm.history.emplace_back(Vector2{0.f, 0.f}, Vector2{10.f, 0.f}, 1.f, BLACK);
+  vm.history.emplace_back(Vector2{500.f, 500.f}, Vector2{510.f, 500.f}, 1.f, BLACK);
+  vm.history.emplace_back(Vector2{0.f, 0.f}, Vector2{1000.f, 1000.f}, 1.f, BLACK);
+  vm.history.emplace_back(Vector2{990.f, 990.f}, Vector2{1000.f, 990.f}, 1.f, BLACK);
+
+  HistoryIndex index{};
+  index.build(vm);
+  ASSERT(!index.isStale(vm), "index is fresh after build");
+
+  vector<unsigned int> found{};
+  index.query(vm, Rectangle{-5.f, -5.f, 20.f, 20.f}, found);
+  ASSERT(found.size() == 2 && found[0] == 0 && found[1] == 2, "query finds the lines around the origin in order");
+
+  index.query(vm, Rectangle{2000.f, 2000.f, 10.f, 10.f}, found);
+  ASSERT(found.empty(), "query outside of the bounds is empty");
+
+  auto hit = index.hitTest(vm, Vector2{503.f, 501.f}, 2.f);
+  ASSERT(hit.has_value() && hit.value() == 2, "hit-test returns the topmost line");
+
+  hit = index.hitTest(vm, Vector2{200.f, 800.f}, 2.f);
+  ASSERT(!hit.has_value(), "hit-test misses empty space");
+
+  vm.setPos(2000.f, 2000.f);
+  vm.forward(10.f);
+  ASSERT(index.isStale(vm), "index is stale after history grew");
+  ASSERT(!index.needsRebuild(vm), "short unindexed tail does not need a rebuild");
+
+  index.query(vm, Rectangle{1995.f, 1980.f, 10.f, 30.f}, found);
+  ASSERT(found.size() == 1 && found[0] == 4, "query finds lines appended after the build");
+
+  // A long diagonal over a fine grid is only registered in the cells it crosses.
+  vm.reset();
+  for (int i = 0; i < 400; i++) {
+    float x = (i % 20) * 50.f;
+    float y = (i / 20) * 50.f;
+    vm.history.emplace_back(Vector2{x, y}, Vector2{x + 5.f, y}, 1.f, BLACK);
+  }
+  vm.history.emplace_back(Vector2{0.f, 0.f}, Vector2{1000.f, 1000.f}, 2.f, BLACK);
+  unsigned int diagonal = vm.history.size() - 1;
+  index.build(vm);
+
+  auto diagonalCells = count(index.cellItems.begin(), index.cellItems.end(), diagonal);
+  ASSERT(index.cols * index.rows >= 64 && diagonalCells <= 3 * max(index.cols, index.rows),
+         "diagonal is only registered in the cells it crosses");
+
+  hit = index.hitTest(vm, Vector2{501.f, 500.f}, 2.f);
+  ASSERT(hit.has_value() && hit.value() == diagonal, "hit-test finds the diagonal");
+
+  index.query(vm, Rectangle{880.f, 80.f, 10.f, 10.f}, found);
+  ASSERT(find(found.begin(), found.end(), diagonal) == found.end(), "query far from the diagonal skips it");
+}
+
+void test_soft_raster() {
+  SoftRasterizer rasterizer{};
+  vector<Color> pixels{};
+  auto pixelAt = [&](int x, int y) -> Color { return pixels[y * 16 + x]; };
+
+  // Pixel aligned 2px wide line: the covered pixels are solid, the rest is untouched.
+  LineHistory history{};
+  history.emplace_back(Vector2{2.f, 8.f}, Vector2{14.f, 8.f}, 2.f, BLACK);
+  rasterizer.render(history, Vector2{0.f, 0.f}, 1.f, 16, 16, WHITE, pixels);
+
+  ASSERT(pixelAt(2, 7).r == 0 && pixelAt(13, 8).r == 0, "thick line covers its pixels");
+  ASSERT(pixelAt(1, 7).r == 255 && pixelAt(14, 8).r == 255, "butt caps end at the line ends");
+  ASSERT(pixelAt(8, 6).r == 255 && pixelAt(8, 9).r == 255, "thick line does not bleed");
+
+  // 1px wide line on a pixel edge: half coverage on both sides.
+  history.clear();
+  history.emplace_back(Vector2{0.f, 8.f}, Vector2{16.f, 8.f}, 1.f, BLACK);
+  rasterizer.render(history, Vector2{0.f, 0.f}, 1.f, 16, 16, WHITE, pixels);
+
+  ASSERT(abs(pixelAt(8, 7).r - 128) <= 1 && abs(pixelAt(8, 8).r - 128) <= 1, "edge aligned line is anti-aliased");
+
+  // Origin and scale map the world onto the image, thickness stays in pixels.
+  rasterizer.render(history, Vector2{0.f, 3.75f}, 2.f, 16, 16, WHITE, pixels);
+  ASSERT(pixelAt(8, 8).r == 0 && pixelAt(8, 7).r == 255, "origin and scale are applied");
+
+  // Multithreaded output is the same as the single threaded one.
+  Lexer lexer{"loop(200) { f(_i0 * 0.7) r(61) }"};
+  Parser parser{lexer};
+  Ast::Program prg = parser.parse();
+  VM vm{};
+  vm.pos = Vector2{128.f, 128.f};
+  prg.execute(&vm);
+
+  vector<Color> multiThreaded{};
+  rasterizer.threadCount = 8;
+  rasterizer.render(vm.history, Vector2{0.f, 0.f}, 1.f, 256, 256, WHITE, multiThreaded);
+  rasterizer.threadCount = 1;
+  rasterizer.render(vm.history, Vector2{0.f, 0.f}, 1.f, 256, 256, WHITE, pixels);
+
+  bool isSame = equal(pixels.begin(), pixels.end(), multiThreaded.begin(), [](Color a, Color b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+  });
+  ASSERT(isSame, "multithreaded rasterization is deterministic");
+}
+
+void test_program_reexecution() {
+  // A parsed program is kept and re-executed by the app when only the variables change.
+  Lexer lexer{"intvar(\"n\", 1, 10, 3) fn sq(s) { loop(4) { f(s) r(90) } } loop(n) { sq(_i0 * 10 + 10) }"};
+  Parser parser{lexer};
+  Ast::Program prg = parser.parse();
+
+  VM vm{};
+  prg.execute(&vm);
+  ASSERT(vm.history.size() == 12, "first execution");
+
+  vm.reset(false, true);
+  vm.frames.front().variable("n") = Value(5.f);
+  prg.execute(&vm);
+  ASSERT(vm.history.size() == 20, "re-execution sees the new variable value");
+
+  LineHistory history = vm.history;
+  vm.reset(false, true);
+  prg.execute(&vm);
+  bool isSame = vm.history.size() == history.size() &&
+                equal(history.begin(), history.end(), vm.history.begin(), [](Line const& a, Line const& b) {
+                  return eqf(a.from.x, b.from.x) && eqf(a.from.y, b.from.y) && eqf(a.to.x, b.to.x) &&
+                         eqf(a.to.y, b.to.y);
+                });
+  ASSERT(isSame, "re-execution is repeatable");
+}
+
+void test_checkpoints() {
+  // Three independent parts, `b` is first read by the second one.
+  Lexer lexer{"intvar(\"a\", 1, 100, 10) intvar(\"b\", 1, 100, 20) f(a) r(90) f(b) r(90) f(10)"};
+  Parser parser{lexer};
+  Ast::Program prg = parser.parse();
+
+  VM vm{};
+  prg.executeFrom(&vm, 0);
+  bool isSparse = vm.checkpoints.size() == 3 && vm.checkpoints[0].statement == 0 && vm.checkpoints[1].statement == 2 &&
+                  vm.checkpoints[2].statement == 4;
+  ASSERT(isSparse, "checkpoints before the start and the first accesses of root variables");
+  ASSERT(vm.firstStatementAccessing({"a"}) == 2 && vm.firstStatementAccessing({"b"}) == 4,
+         "first root variable accesses are recorded");
+  ASSERT(!vm.firstStatementAccessing({"c"}).has_value(), "unused variable has no access");
+
+  unsigned int generation = vm.historyGeneration;
+  ASSERT(vm.restoreCheckpoint(5) == 4, "the closest earlier checkpoint restores");
+  ASSERT(vm.history.size() == 1 && vm.historyGeneration != generation, "restore drops the later lines");
+
+  vm.frames.front().variable("b") = Value(50.f);
+  prg.executeFrom(&vm, 4);
+
+  VM fullVm{};
+  fullVm.frames.front().variable("b") = Value(50.f);
+  prg.execute(&fullVm);
+
+  bool isSame = vm.history.size() == fullVm.history.size() &&
+                equal(vm.history.begin(), vm.history.end(), fullVm.history.begin(), [](Line const& a, Line const& b) {
+                  return eqf(a.from.x, b.from.x) && eqf(a.from.y, b.from.y) && eqf(a.to.x, b.to.x) &&
+                         eqf(a.to.y, b.to.y);
+                });
+  ASSERT(isSame && eqf(vm.angle, fullVm.angle), "resumed execution matches a full run");
+
+  // clear() drops the history, the checkpoints before it can't be restored anymore.
+  Lexer clearLexer{"f(10) clear() x = 1 f(x)"};
+  Parser clearParser{clearLexer};
+  Ast::Program clearPrg = clearParser.parse();
+  VM clearVm{};
+  clearPrg.executeFrom(&clearVm, 0);
+  ASSERT(!clearVm.restoreCheckpoint(1) && clearVm.restoreCheckpoint(3) == 2, "clear invalidates earlier checkpoints");
+
+  // Long programs are checkpointed every CHECKPOINT_INTERVAL statements, and the checkpoints share what the program
+  // defined while it didn't change.
+  string longCode{"fn sq(s) { loop(4) { f(s) r(90) } }"};
+  for (int i = 0; i < 200; i++) longCode += " sq(" + to_string(i % 7 + 1) + ")";
+  Lexer longLexer{longCode};
+  Parser longParser{longLexer};
+  Ast::Program longPrg = longParser.parse();
+  VM longVm{};
+  longPrg.executeFrom(&longVm, 0);
+  ASSERT(longVm.checkpoints.size() == 4 && longVm.checkpoints.back().statement == 3 * VM::CHECKPOINT_INTERVAL,
+         "checkpoints of long programs are sparse");
+  ASSERT(longVm.checkpoints[1].definitions == longVm.checkpoints.back().definitions &&
+             longVm.checkpoints[0].definitions != longVm.checkpoints[1].definitions,
+         "checkpoints share the definitions");
+
+  optional<size_t> restored = longVm.restoreCheckpoint(100);
+  ASSERT(restored == VM::CHECKPOINT_INTERVAL, "resumes from the checkpoint before");
+  longPrg.executeFrom(&longVm, restored.value());
+  VM longFullVm{};
+  longPrg.execute(&longFullVm);
+  ASSERT(longVm.history.size() == longFullVm.history.size() && eqf(longVm.pos.x, longFullVm.pos.x) &&
+             eqf(longVm.pos.y, longFullVm.pos.y),
+         "a run resumed from a sparse checkpoint matches a full run");
+}
+
+void test_start_invariance() {
+  auto isInvariant = [](const char* code) -> bool {
+    Lexer lexer{code};
+    Parser parser{lexer};
+    return Ast::isStartInvariant(parser.parse());
+  };
+
+  ASSERT(isInvariant("fn sq(s) { loop(4) { f(s) r(90) } } if (1 < 2) { sq(10) } u() f(3) d() t(2) sq(5)"),
+         "relative moves are start invariant");
+  ASSERT(!isInvariant("fn g() { f(getx()) } g()"), "getx in a function is not start invariant");
+  ASSERT(!isInvariant("loop(3) { pos(10, 10) }"), "pos is not start invariant");
+  ASSERT(!isInvariant("f(winw() / 2)"), "winw is not start invariant");
+
+  // Moving the drawing gives the same lines as running it from the new start.
+  Lexer lexer{"fn tree(n) { if (n > 0) { f(n * 3) l(25) tree(n - 1) r(50) tree(n - 1) l(25) b(n * 3) } } tree(6)"};
+  Parser parser{lexer};
+  Ast::Program prg = parser.parse();
+
+  VM vm{};
+  vm.pos = Vector2{100.f, 200.f};
+  vm.angle = 10.f;
+  prg.executeFrom(&vm, 0);
+  unsigned int generation = vm.historyGeneration;
+  ASSERT(vm.transformFromStart(Vector2{300.f, 50.f}, 75.f), "history transforms");
+
+  VM fullVm{};
+  fullVm.pos = Vector2{300.f, 50.f};
+  fullVm.angle = 75.f;
+  prg.execute(&fullVm);
+
+  bool isSame = vm.history.size() == fullVm.history.size() &&
+                equal(vm.history.begin(), vm.history.end(), fullVm.history.begin(), [](Line const& a, Line const& b) {
+                  return eqf(a.from.x, b.from.x, 0.01f) && eqf(a.from.y, b.from.y, 0.01f) &&
+                         eqf(a.to.x, b.to.x, 0.01f) && eqf(a.to.y, b.to.y, 0.01f);
+                });
+  ASSERT(isSame && eqf(vm.pos.x, fullVm.pos.x, 0.01f) && eqf(vm.angle, fullVm.angle),
+         "transformed history matches a run from the new start");
+  ASSERT(vm.historyGeneration != generation, "transform is a new history generation");
+}
+
+void test_call_culling() {
+  Lexer lexer{"fn tree(n) { if (n > 0) { f(n * 4) l(30) tree(n - 1) r(60) tree(n - 1) l(30) b(n * 4) } } tree(10)"};
+  Parser parser{lexer};
+  Ast::Program prg = parser.parse();
+
+  VM fullVm{};
+  fullVm.pos = Vector2{500.f, 500.f};
+  prg.execute(&fullVm);
+
+  VM vm{};
+  vm.pos = Vector2{500.f, 500.f};
+  vm.culling.isEnabled = true;
+  vm.culling.rect = Rectangle{440.f, 420.f, 30.f, 30.f};
+  prg.execute(&vm);
+
+  ASSERT(vm.culling.skippedCallCount > 0 && vm.history.size() < fullVm.history.size(), "off-screen calls are skipped");
+  ASSERT(eqf(vm.pos.x, fullVm.pos.x, 0.01f) && eqf(vm.pos.y, fullVm.pos.y, 0.01f) && eqf(vm.angle, fullVm.angle),
+         "skipped calls still move the turtle");
+
+  auto isVisible = [&](Line const& line) {
+    return HistoryIndex::overlaps(HistoryIndex::lineBounds(line), vm.culling.rect);
+  };
+  auto visibleCount = [&](LineHistory const& history) { return count_if(history.begin(), history.end(), isVisible); };
+  ASSERT(visibleCount(vm.history) == visibleCount(fullVm.history), "lines in the culling rect are all drawn");
+
+  // Functions reading absolute state are never culled.
+  Lexer absLexer{"fn g(n) { if (n > 0) { f(getx() * 0 + 5) g(n - 1) } } loop(10) { g(5) r(36) }"};
+  Parser absParser{absLexer};
+  Ast::Program absPrg = absParser.parse();
+  VM absVm{};
+  absVm.culling.isEnabled = true;
+  absVm.culling.rect = Rectangle{-1000.f, -1000.f, 1.f, 1.f};
+  absPrg.execute(&absVm);
+  ASSERT(absVm.culling.skippedCallCount == 0 && absVm.history.size() == 50, "absolute functions are not culled");
+
+  // Every distinct argument is a key of its own, the learned effects are capped.
+  CallCulling culling{};
+  CallKey key{nullptr, {}, 1, true, 1.f};
+  for (size_t i = 0; i < CallCulling::MAX_EFFECTS + 10; i++) {
+    key.args[0] = (float)i;
+    culling.learn(key, CallEffect{Vector2{0.f, 1.f}, 0.f, true, 1.f, 1.f, 1.f, 1, true});
+  }
+  ASSERT(culling.effects.size() <= CallCulling::MAX_EFFECTS, "learned effects are capped");
+}
+
+void test_call_lod() {
+  Lexer lexer{"fn tree(n) { if (n > 0) { f(n * 4) l(30) tree(n - 1) r(60) tree(n - 1) l(30) b(n * 4) } } tree(10)"};
+  Parser parser{lexer};
+  Ast::Program prg = parser.parse();
+
+  VM fullVm{};
+  prg.execute(&fullVm);
+
+  // At 0.03 pixels per unit the drawing of the calls with n <= 2 stays within half a pixel.
+  VM vm{};
+  vm.culling.isLodEnabled = true;
+  vm.culling.lodScale = 0.03f;
+  vm.culling.lodThreshold = 0.5f;
+  prg.execute(&vm);
+
+  ASSERT(vm.culling.prunedCallCount > 0 && vm.history.size() < fullVm.history.size() / 2, "small calls are pruned");
+  ASSERT(eqf(vm.pos.x, fullVm.pos.x, 0.01f) && eqf(vm.pos.y, fullVm.pos.y, 0.01f) && eqf(vm.angle, fullVm.angle),
+         "pruned calls still move the turtle");
+
+  VM closeVm{};
+  closeVm.culling.isLodEnabled = true;
+  closeVm.culling.lodScale = 1.f;
+  prg.execute(&closeVm);
+  ASSERT(closeVm.history.size() == fullVm.history.size(), "nothing visible is pruned");
+
+  // Runs `code` with LOD at `lodScale` and without, true if nothing was pruned and both end at the same place.
+  auto isNotPruned = [](const char* code, float lodScale) -> bool {
+    Lexer lexer{code};
+    Parser parser{lexer};
+    Ast::Program prg = parser.parse();
+    VM fullVm{};
+    fullVm.pos = Vector2{599.f, 100.f};
+    prg.execute(&fullVm);
+    VM vm{};
+    vm.pos = Vector2{599.f, 100.f};
+    vm.culling.isLodEnabled = true;
+    vm.culling.lodScale = lodScale;
+    prg.execute(&vm);
+    return vm.culling.prunedCallCount == 0 && vm.history.size() == fullVm.history.size() &&
+           eqf(vm.pos.x, fullVm.pos.x, 0.01f) && eqf(vm.pos.y, fullVm.pos.y, 0.01f);
+  };
+
+  // The drawing of functions reading or setting the absolute turtle state depends on where they start.
+  ASSERT(isNotPruned("fn g() { if (getx() > 600) { pos(100, 100) } else { f(0.1) } } r(90) loop(30) { g() f(0.1) }",
+                     1.f),
+         "absolute calls are not pruned");
+  // Calls that return to their start are pruned by the size of their drawing, learned per argument.
+  auto isPruned = [](const char* code, float lodScale) -> bool {
+    Lexer lexer{code};
+    Parser parser{lexer};
+    Ast::Program prg = parser.parse();
+    VM fullVm{};
+    prg.execute(&fullVm);
+    VM vm{};
+    vm.culling.isLodEnabled = true;
+    vm.culling.lodScale = lodScale;
+    prg.execute(&vm);
+    return vm.culling.prunedCallCount > 0 && vm.history.size() < fullVm.history.size() &&
+           eqf(vm.pos.x, fullVm.pos.x, 0.01f) && eqf(vm.pos.y, fullVm.pos.y, 0.01f) && eqf(vm.angle, fullVm.angle);
+  };
+  ASSERT(isPruned("fn g(n) { x = getx() y = gety() a = getangle() if (n > 1) { f(n) r(20) g(n * 0.7) l(40) "
+                  "g(n * 0.7) } pos(x, y) angle(a) } g(60)",
+                  0.1f),
+         "calls restoring the turtle are pruned");
+  ASSERT(isPruned("fn g(n) { f(n) if (n > 1) { a = rand(10, 40) l(a) g(n * 0.7) r(a * 2) g(n * 0.7) l(a) } b(n) } "
+                  "g(60)",
+                  0.1f),
+         "calls with random angles are pruned");
+  // Short moves can still draw a big shape.
+  ASSERT(isNotPruned("fn circ(s) { loop(360) { f(s) r(1) } } loop(6) { circ(0.3) f(50) }", 1.f),
+         "calls drawing beyond the threshold are not pruned");
+}
+
+void test_refinement() {
+  RefinementScheduler scheduler{};
+  ASSERT(!scheduler.isDrafting(0.0), "no drafts without an active slider");
+
+  scheduler.updateSliders(true, true, 10.0);
+  ASSERT(scheduler.isDrafting(10.1), "a moving slider drafts");
+  scheduler.isDraftShown = true;
+  ASSERT(!scheduler.needsRefinement(10.1), "no refinement while the slider moves");
+  ASSERT(scheduler.needsRefinement(10.0 + RefinementScheduler::IDLE_TIME), "an idle slider refines");
+
+  scheduler.updateSliders(false, false, 10.1);
+  ASSERT(scheduler.needsRefinement(10.1), "a released slider refines");
+
+  // Drafts end at the line budget, without an error.
+  Lexer lexer{"loop(100) { f(1) }"};
+  Parser parser{lexer};
+  Ast::Program prg = parser.parse();
+  VM vm{};
+  vm.lineBudget = 10;
+  RunTimes times{};
+  bool isOk = executeLogo(prg, &vm, &times, 0);
+  ASSERT(isOk && vm.history.size() == 10 && !vm.isCheckpointComplete, "runs end at the line budget");
+
+  // The budget counts the lines of the run, line() included.
+  Lexer lineLexer{"loop(100) { line(0, 0, 1, 1) }"};
+  Parser lineParser{lineLexer};
+  Ast::Program linePrg = lineParser.parse();
+  isOk = executeLogo(linePrg, &vm, &times);
+  ASSERT(isOk && vm.history.size() == 20, "line() spends the budget of its own run");
+}
+
+void test_profiler() {
+  Lexer lexer{"fn g(n) { f(1) if (n > 0) { g(n - 1) } } g(3) a = 90 r(a)"};
+  Parser parser{lexer};
+  Ast::Program prg = parser.parse();
+
+  VM vm{};
+  vm.profiler.isEnabled = true;
+  RunTimes times{};
+  executeLogo(prg, &vm, &times);
+
+  auto rows = vm.profiler.rows();
+  auto find = [&](string const& name) {
+    return *find_if(rows.begin(), rows.end(), [&](ProfileRow const& row) { return row.name == name; });
+  };
+  ProfileRow g = find("g");
+  ProfileRow forward = find("forward");
+  ASSERT(rows.size() == 3 && g.stats.calls == 4 && forward.stats.calls == 4 && find("right").stats.calls == 1,
+         "calls are counted per function");
+  ASSERT(g.stats.segments == 4 && forward.stats.segments == 4, "recursive calls count their segments once");
+  ASSERT(g.stats.inclusive >= g.stats.exclusive && g.stats.exclusive > 0.0, "exclusive time is part of inclusive");
+
+  ostringstream json{};
+  vm.profiler.writeJson(json);
+  ASSERT(json.str().find("{\"name\": \"g\", \"builtin\": false, \"calls\": 4") != string::npos, "profile as JSON");
+
+  // A resumed run only profiles the statements it executed.
+  executeLogo(prg, &vm, &times, 0);
+  size_t resumeFrom = vm.restoreCheckpoint(2).value_or(0);
+  executeLogo(prg, &vm, &times, resumeFrom);
+  rows = vm.profiler.rows();
+  ASSERT(resumeFrom == 2 && vm.profiler.firstStatement == 2 && rows.size() == 1 && rows[0].name == "right",
+         "a resumed profile starts at the resumed statement");
+
+  VM offVm{};
+  executeLogo(prg, &offVm, &times);
+  ASSERT(offVm.profiler.rows().empty(), "disabled profiler records nothing");
+}
+
+void test_arena() {
+  Arena arena{};
+  char* c = arena.make<char>('x');
+  double* d = arena.make<double>(1.5);
+  ASSERT(*c == 'x' && *d == 1.5, "arena objects are constructed");
+  ASSERT(reinterpret_cast<uintptr_t>(d) % alignof(double) == 0, "arena objects are aligned");
+
+  vector<int> big(Arena::MAX_CHUNK_SIZE, 7);
+  ArenaList<int> list = arena.makeList(big.data(), big.size());
+  ASSERT(list.size() == big.size() && list[list.size() - 1] == 7, "lists bigger than a chunk fit");
+  ASSERT(arena.reserved() >= arena.used() && arena.used() >= big.size() * sizeof(int), "arena accounting");
+  ASSERT(arena.makeList<int>(nullptr, 0).empty(), "empty list");
+
+  // Functions keep the AST of the program that defined them alive.
+  VM vm{};
+  RunTimes times{};
+  {
+    auto defining = compileLogo("fn sq(s) { loop(4) { f(s) r(90) } }", &times);
+    executeLogo(defining.value(), &vm, &times);
+  }
+  ASSERT(runLogo("sq(10)", &vm, &times), "a function outlives its program");
+  ASSERT(vm.history.size() == 4, "the function draws");
+}
+
+void test_reparse() {
+  RunTimes times{};
+  string code = "fn sq(s) { loop(4) { f(s) r(90) } }\nsq(10)\nr(45) # turn\nsq(20)\n";
+  ASSERT(compileLogo(code, &times).value().statementStarts == (vector<size_t>{0, 36, 43, 56}),
+         "top-level statements start offsets");
+
+  // Source lines of the calls, in the order they are in the program.
+  auto callLines = [](Ast::Program const& prg) {
+    vector<uint32_t> lines{};
+    function<void(Ast::Node const&)> collect = [&](Ast::Node const& node) {
+      if (node.asFnCall() != nullptr) lines.push_back(node.asFnCall()->sourceLine());
+      node.eachChild(collect);
+    };
+    prg.eachChild(collect);
+    return lines;
+  };
+
+  // Draws like a full compile of the edited source.
+  auto assertReparse = [&](string const& edited, size_t firstChanged, bool didFunctionsChange) {
+    auto old = compileLogo(code, &times);
+    auto reparsed = reparse(old.value(), code, edited);
+    ASSERT(reparsed.has_value(), "edit re-parses");
+    ASSERT(reparsed->firstChanged == firstChanged, "first changed statement");
+    ASSERT(reparsed->didFunctionsChange == didFunctionsChange, "function changes");
+    ASSERT(reparsed->program.statements[0] == old.value().statements[0] || firstChanged == 0,
+           "unchanged statements keep their nodes");
+
+    auto full = compileLogo(edited, &times);
+    ASSERT(reparsed->program.statementStarts == full.value().statementStarts, "statement offsets of a full compile");
+    ASSERT(callLines(reparsed->program) == callLines(full.value()), "call lines of a full compile");
+    VM reparsedVm{};
+    VM fullVm{};
+    executeLogo(reparsed->program, &reparsedVm, &times);
+    executeLogo(full.value(), &fullVm, &times);
+    ASSERT(reparsedVm.history.size() == fullVm.history.size() && eqf(reparsedVm.pos.x, fullVm.pos.x) &&
+               eqf(reparsedVm.pos.y, fullVm.pos.y),
+           "re-parsed program draws like a full compile");
+  };
+
+  assertReparse("fn sq(s) { loop(4) { f(s) r(90) } }\nsq(10)\nr(45) # turn\nsq(25)\n", 3, false);
+  assertReparse("fn sq(s) { loop(4) { f(s) r(90) } }\nsq(10)\nr(45) # turn\nsq(20)\nsq(5)\n", 4, false);
+  assertReparse("fn sq(s) { loop(3) { f(s) r(120) } }\nsq(10)\nr(45) # turn\nsq(20)\n", 0, true);
+  assertReparse("fn sq(s) { loop(4) { f(s) r(90) } }\nsq(10)\n\nr(45) # turn\nsq(20)\n", 4, false);
+  assertReparse("# squares\nfn sq(s) { loop(4) { f(s) r(90) } }\nsq(10)\nr(45) # turn\nsq(20)\n", 4, false);
+
+  // Kept statements after a line added in a function move down with it.
+  string calls = "f(1)\nf(2)\n\nfn g() {\n  f(3)\n}\ng()\nr(5)\n";
+  string callsEdited = "f(1)\nf(2)\n\nfn g() {\n  f(3)\n  f(4)\n}\ng()\nr(5)\n";
+  auto callsOld = compileLogo(calls, &times);
+  auto callsReparsed = reparse(callsOld.value(), calls, callsEdited);
+  ASSERT(callsReparsed.has_value() && callLines(callsReparsed->program) == (vector<uint32_t>{1, 2, 5, 6, 8, 9}),
+         "kept statements move to their new lines");
+
+  string nested = "if (1 < 2) { fn sq(s) { loop(4) { f(s) r(90) } } }\nsq(10)\n";
+  auto nestedOld = compileLogo(nested, &times);
+  auto nestedReparsed =
+      reparse(nestedOld.value(), nested, "if (1 < 2) { fn sq(s) { loop(3) { f(s) r(120) } } }\nsq(10)\n");
+  ASSERT(nestedReparsed.has_value() && nestedReparsed->firstChanged == 0 && nestedReparsed->didFunctionsChange,
+         "a function changed in a block is a function change");
+
+  auto old = compileLogo(code, &times);
+  auto line = compileLogo("f(1)  f(2)\n", &times);
+  ASSERT(!reparse(line.value(), "f(1)  f(2)\n", "f(1) # f(2)\n"),
+         "an edit that comments out the following statements is compiled again");
+  ASSERT(!reparse(old.value(), code, "fn sq(s) { loop(4) { f(s) r(90) } }\nsq(10\nr(45) # turn\nsq(20)\n"),
+         "parse errors are left to a full compile");
+
+  // The re-parsed statements stay in the storage until it holds about as much as a full compile.
+  string edited = code;
+  size_t reparseCount{0};
+  while (true) {
+    edited.back() = edited.back() == '\n' ? ' ' : '\n';
+    auto reparsed = reparse(old.value(), code, edited);
+    if (!reparsed.has_value()) break;
+    old = std::move(reparsed->program);
+    code = edited;
+    reparseCount++;
+  }
+  ASSERT(reparseCount > 1 && reparseCount < code.size(), "storage growth falls back to a full compile");
+}
+
+void test_memory_stats() {
+  int64_t astBefore = memoryStats.live(MemoryKind::Ast);
+  int64_t stringsBefore = memoryStats.live(MemoryKind::Strings);
+  RunTimes times{};
+  {
+    auto prg = compileLogo("fn tri(s, d) { if (d > 0) { loop(3) { tri(s / 2, d - 1) f(s) r(120) } } }\n"
+                           "x = 5 loop(4) { push(x) tri(x * 20, 4) x = pop() + 1 r(90) }\n",
+                           &times);
+    ASSERT(memoryStats.live(MemoryKind::Ast) > astBefore, "the AST is counted");
+
+    VM vm{};
+    for (int i = 0; i < 3; i++) {
+      vm.reset();
+      executeLogo(prg.value(), &vm, &times);
+    }
+    ASSERT(memoryStats.live(MemoryKind::History) >= (int64_t)(vm.history.size() * sizeof(Line)), "history is counted");
+    ASSERT(memoryStats.live(MemoryKind::Frames) > 0 && memoryStats.live(MemoryKind::Stack) > 0,
+           "frames and the stack are counted");
+
+    // Once warmed up, the frames, the function entries, the stack and the history keep their memory across runs.
+    AllocStats before = allocStats();
+    for (int i = 0; i < 3; i++) {
+      vm.reset();
+      executeLogo(prg.value(), &vm, &times);
+    }
+    AllocStats allocs = allocStats() - before;
+    ASSERT(vm.history.size() == 4 * 120, "the program draws");
+    ASSERT(allocs.count == 0, "numeric programs execute without allocating");
+
+    {
+      Value s{string{"hello"}};
+      Value copy{s};
+      ASSERT(memoryStats.live(MemoryKind::Strings) == stringsBefore + 12, "string values are counted");
+    }
+    ASSERT(memoryStats.live(MemoryKind::Strings) == stringsBefore, "string values are released");
+  }
+  ASSERT(memoryStats.live(MemoryKind::Ast) == astBefore, "the AST is released with the program");
+  ASSERT(memoryStats.peak(MemoryKind::Ast) > astBefore, "the peak stays");
+
+  // Variable names longer than the inline buffer of a string count into their frame.
+  auto frameBytes = [](string_view name) -> int64_t {
+    int64_t before = memoryStats.live(MemoryKind::Frames);
+    Frame frame{};
+    frame.variable(name) = Value(1.f);
+    return memoryStats.live(MemoryKind::Frames) - before;
+  };
+  ASSERT(frameBytes(string(40, 'x')) >= frameBytes("x") + 41, "variable names are counted");
+
+  // Checkpoints count apart from the live VM state.
+  int64_t checkpointsBefore = memoryStats.live(MemoryKind::Checkpoints);
+  int64_t framesBefore = memoryStats.live(MemoryKind::Frames);
+  {
+    auto prg = compileLogo("fn sq(s) { loop(4) { f(s) r(90) } } a = 5 sq(a) r(10) b = 2 sq(b)", &times);
+    VM vm{};
+    int64_t vmFrames = memoryStats.live(MemoryKind::Frames);
+    executeLogo(prg.value(), &vm, &times, 0);
+    ASSERT(vm.checkpoints.size() == 3 && memoryStats.live(MemoryKind::Checkpoints) > checkpointsBefore,
+           "checkpoints are counted");
+    int64_t checkpointBytes = memoryStats.live(MemoryKind::Checkpoints) - checkpointsBefore;
+    ASSERT(memoryStats.live(MemoryKind::Frames) - vmFrames < checkpointBytes, "checkpoints are not counted as frames");
+  }
+  ASSERT(memoryStats.live(MemoryKind::Checkpoints) == checkpointsBefore &&
+             memoryStats.live(MemoryKind::Frames) == framesBefore,
+         "checkpoints are released with the VM");
+}
+
+void test_sampler() {
+  string path = (filesystem::temp_directory_path() / "plogo_test_samples.folded").string();
+  sampler.listen();
+  sampler.setScript("tests");
+  sampler.start(path);
+
+  // A sample is taken at the first call after the timer marked it due.
+  VM vm{};
+  RunTimes times{};
+  auto program = compileLogo("fn leaf(n) { loop(n) { f(1) } }\nfn tree(n) {\n  leaf(n)\n}\ntree(20000)\n", &times);
+  auto t_start = chrono::steady_clock::now();
+  while (sampler.sampleCount() < 10 && secondsSince(t_start) < 5.f) {
+    vm.reset();
+    executeLogo(program.value(), &vm, &times);
+  }
+  ASSERT(sampler.sampleCount() >= 10, "the timer thread takes samples");
+  ASSERT(vm.shadowStack.empty(), "calls pop their shadow frames");
+
+  raise(SIGUSR1);
+  t_start = chrono::steady_clock::now();
+  while (sampler.isSampling() && secondsSince(t_start) < 5.f) this_thread::sleep_for(chrono::milliseconds(10));
+  ASSERT(!sampler.isSampling(), "SIGUSR1 toggles sampling");
+
+  ifstream file{path};
+  string folded{istreambuf_iterator<char>(file), {}};
+  ASSERT(folded.find("tests;tree:5;leaf:3;f:1 ") != string::npos, "folded stacks of function and call line");
+  sampler.shutdown();
+  filesystem::remove(path);
+}
+
+void test_trace() {
+  Tracer localTracer{};
+  TraceBuffer* mainBuffer = localTracer.acquire();
+  mainBuffer->push(TraceEvent{"outer", 1000, 5000});
+  for (size_t i = 0; i < TraceBuffer::CAPACITY + 10; i++) mainBuffer->push(TraceEvent{"inner", 2000, 1000});
+
+  TraceBuffer* workerBuffer{nullptr};
+  thread worker{[&]() {
+    workerBuffer = localTracer.acquire();
+    workerBuffer->push(TraceEvent{"worker", 1500, 500});
+    localTracer.release(workerBuffer);
+  }};
+  worker.join();
+
+  ostringstream json{};
+  size_t eventCount = localTracer.writeChromeJson(json);
+  ASSERT(eventCount == TraceBuffer::CAPACITY + 1, "the ring keeps the last spans per thread");
+  ASSERT(json.str().find("\"outer\"") == string::npos, "old spans are overwritten");
+  ASSERT(json.str().find(
+             "{\"name\": \"worker\", \"ph\": \"X\", \"pid\": 1, \"tid\": 2, \"ts\": 1.500, \"dur\": 0.500}") !=
+             string::npos,
+         "spans are complete events in microseconds");
+  ASSERT(localTracer.acquire() == workerBuffer, "buffers of finished threads are reused");
+
+  // Two hours in, a span 200 ns after another one still starts after it.
+  Tracer lateTracer{};
+  TraceBuffer* lateBuffer = lateTracer.acquire();
+  lateBuffer->push(TraceEvent{"frame", 7'200'000'000'000, 16'000'000});
+  lateBuffer->push(TraceEvent{"draw", 7'200'000'000'200, 1'000});
+  ostringstream lateJson{};
+  lateJson.precision(2);
+  lateTracer.writeChromeJson(lateJson);
+  ASSERT(lateJson.str().find("\"ts\": 7200000000.000, \"dur\": 16000.000") != string::npos &&
+             lateJson.str().find("\"ts\": 7200000000.200, \"dur\": 1.000") != string::npos,
+         "late spans keep their sub-microsecond start");
+  ASSERT(lateJson.precision() == 2, "the stream format is kept");
+
+  {
+    TRACE_SCOPE("scope");
+  }
+  ostringstream globalJson{};
+  tracer.writeChromeJson(globalJson);
+  ASSERT(globalJson.str().find("\"scope\"") != string::npos, "scopes record into the global tracer");
+}
+
+void test_vector_export() {
+  // Two connected lines form one run, the disjoint third line starts a new one, the thicker fourth a new group.
+  LineHistory history{};
+  history.emplace_back(Vector2{0.f, 0.f}, Vector2{10.04f, 0.f}, 1.f, BLACK);
+  history.emplace_back(Vector2{10.04f, 0.f}, Vector2{10.f, 10.f}, 1.f, BLACK);
+  history.emplace_back(Vector2{20.f, 20.f}, Vector2{30.f, 20.f}, 1.f, BLACK);
+  history.emplace_back(Vector2{30.f, 20.f}, Vector2{30.f, 30.f}, 2.5f, BLACK);
+
+  ostringstream svg{};
+  exportSvg(history, Vector2{100.f, 50.f}, svg);
+  string svgText = svg.str();
+
+  ASSERT(svgText.find("viewBox=\"0 0 100 50\"") != string::npos, "svg has the world size");
+  ASSERT(svgText.find("points=\"0,0 10,0 10,10\"") != string::npos, "svg joins connected lines into a polyline");
+  ASSERT(svgText.find("points=\"20,20 30,20\"") != string::npos, "svg starts a new run after a gap");
+  ASSERT(svgText.find("stroke-width=\"2.5\"") != string::npos, "svg groups by thickness");
+
+  VectorExportOptions coarse{.precision = 5.f};
+  ostringstream svgCoarse{};
+  exportSvg(history, Vector2{100.f, 50.f}, svgCoarse, coarse);
+  ASSERT(svgCoarse.str().find("points=\"0,0 10,0 10,10\"") != string::npos, "svg coordinates are quantized");
+
+  // Widths and colors keep their decimals at a coarse precision.
+  LineHistory thin{};
+  thin.emplace_back(Vector2{0.f, 0.f}, Vector2{10.f, 0.f}, 0.4f, Color{128, 64, 200, 128});
+  VectorExportOptions whole{.precision = 1.f};
+  ostringstream svgThin{};
+  exportSvg(thin, Vector2{100.f, 50.f}, svgThin, whole);
+  string svgThinText = svgThin.str();
+  ASSERT(svgThinText.find("stroke-width=\"0.4\"") != string::npos, "svg keeps thin widths");
+  ASSERT(svgThinText.find("stroke-opacity=\"0.502\"") != string::npos, "svg opacity is not rounded to the precision");
+
+  ostringstream pdfThin{};
+  exportPdf(thin, Vector2{100.f, 50.f}, pdfThin, whole);
+  ASSERT(pdfThin.str().find("0.502 0.251 0.784 RG 0.4 w") != string::npos, "pdf color is not rounded to the precision");
+
+  ostringstream pdf{};
+  exportPdf(history, Vector2{100.f, 50.f}, pdf);
+  string pdfText = pdf.str();
+
+  ASSERT(pdfText.starts_with("%PDF-1.4") && pdfText.ends_with("%%EOF\n"), "pdf has header and trailer");
+  ASSERT(pdfText.find("0 50 m\n10 50 l\n10 40 l\nS\n") != string::npos, "pdf flips y and joins connected lines");
+
+  size_t startxrefPos = pdfText.rfind("startxref\n");
+  size_t xrefOffset = stoul(pdfText.substr(startxrefPos + 10));
+  ASSERT(pdfText.compare(xrefOffset, 4, "xref") == 0, "pdf startxref points at the xref table");
+
+  // xref entries are 20 bytes each, the one of object 4 (the content stream) comes after the free entry and 1-3.
+  size_t contentOffset = stoul(pdfText.substr(xrefOffset + strlen("xref\n0 6\n") + 4 * 20, 10));
+  ASSERT(pdfText.compare(contentOffset, 8, "4 0 obj\n") == 0, "pdf xref points at the objects");
+}
+
 int main() {
   INFO("start");
 
@@ -172,6 +920,8 @@ int main() {
                                      {LexemeKind::Name, "x"},
                                  });
 
+  test_lexeme_values();
+
   test_vm("forward(10)", [](VM* vm) {
     ASSERT(eqf(vm->angle, 0.0), "angle is 0");
     ASSERT(eqf(vm->pos.x, 0.0), "x is 0.0");
@@ -213,6 +963,15 @@ int main() {
   test_vm("f(10 + (15 % 10))", [](VM* vm) { ASSERT(eqf(vm->pos.y, -15.0), "y is -15.0"); });
   test_vm("f((((14))))", [](VM* vm) { ASSERT(eqf(vm->pos.y, -14.0), "y is -14.0"); });
 
+  test_vm("f(10) r(90) f(10)", [](VM* vm) {
+    ASSERT(vm->history.size() == 2, "history grew by 2 lines");
+    ASSERT(vm->historyGeneration == 0, "history generation is untouched by appends");
+  });
+  test_vm("f(10) clear() f(5)", [](VM* vm) {
+    ASSERT(vm->history.size() == 1, "history is dropped by clear");
+    ASSERT(vm->historyGeneration == 1, "history generation is bumped by clear");
+  });
+
   // Error scenarios:
   test_vm_raise("forward");
   test_vm_raise("forward()");
@@ -224,6 +983,28 @@ int main() {
   // Value object testing.
   test_value();
 
+  test_history_index();
+
+  test_soft_raster();
+
+  test_program_reexecution();
+
+  test_checkpoints();
+
+  test_start_invariance();
+
+  test_call_culling();
+  test_call_lod();
+  test_refinement();
+  test_profiler();
+  test_trace();
+  test_sampler();
+  test_arena();
+  test_reparse();
+  test_memory_stats();
+
+  test_vector_export();
+
   if (failCount == 0) {
     PASS("all");
   } else {
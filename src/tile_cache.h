@@ -0,0 +1,346 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#include "history_index.h"
+#include "line_shader.h"
+#include "memory_stats.h"
+#include "raylib.h"
+#include "raymath.h"
+#include "util.h"
+#include "vm.h"
+
+using namespace std;
+
+// We need to render the logo drawing high scale as textures rasterize lines without smoothing. Downscaling gives
+// us a little bit of smooothing. 2 seems to be the sweet spot with trilinear texture filter.
+constexpr float DRAW_TEXTURE_SCALE = 2.f;
+
+enum class LineMode {
+  // DrawLineEx into DRAW_TEXTURE_SCALE sized tiles.
+  Supersampled,
+  // LineShader into native sized tiles.
+  Analytic,
+};
+
+struct TileKey {
+  int level;
+  int x;
+  int y;
+
+  bool operator==(TileKey const &other) const = default;
+};
+
+struct TileKeyHash {
+  size_t operator()(TileKey const &key) const {
+    return ((size_t)(key.level + 64) * 73856093u) ^ ((size_t)key.x * 19349663u) ^ ((size_t)key.y * 83492791u);
+  }
+};
+
+struct Tile {
+  RenderTexture2D texture;
+  unsigned long lastUsedFrame;
+  // Factor of the line widths the tile was rasterized with (see TileCache::lineScaleForZoom).
+  float lineScale;
+};
+
+// An RGBA color buffer and a depth buffer (24 bit, padded to 32) per pixel.
+constexpr int64_t TILE_TEXTURE_BYTES_PER_PIXEL = 8;
+
+inline RenderTexture2D loadTileTexture(int size) {
+  RenderTexture2D texture = LoadRenderTexture(size, size);
+  memoryStats.add(MemoryKind::Textures,
+                  (size_t)texture.texture.width * texture.texture.height * TILE_TEXTURE_BYTES_PER_PIXEL);
+  return texture;
+}
+
+inline void unloadTileTexture(RenderTexture2D const &texture) {
+  memoryStats.remove(MemoryKind::Textures,
+                     (size_t)texture.texture.width * texture.texture.height * TILE_TEXTURE_BYTES_PER_PIXEL);
+  UnloadRenderTexture(texture);
+}
+
+// Pyramid of cached tile textures over the world. Level `l` holds the drawing at 2^l zoom in TILE_SIZE screen pixel
+// tiles. Panning only rasterizes the newly exposed tiles, and while the tiles of a new zoom level are being built
+// (at most MAX_TILE_RASTERS_PER_FRAME per frame) the closest cached coarser level is drawn in their place.
+// Line thickness is in screen pixels on all levels, so deep zooms keep the lines crisp.
+//
+// In LineMode::Analytic tiles are rendered at native resolution (a quarter of the pixels of the supersampled tiles)
+// and the level is picked so that tiles are only ever scaled down on screen - by up to 2x, so the lines are widened by
+// the ratio of the level's zoom to the camera zoom to keep their thickness on screen. The ratio is rounded to
+// LINE_SCALE_STEPS steps per level, and visible tiles of another step are rasterized again like missing ones.
+struct TileCache {
+  static constexpr int TILE_SIZE = 256;
+  static constexpr int MIN_LEVEL = -6;
+  static constexpr int MAX_LEVEL = 12;
+  static constexpr int MAX_TILES = 128;
+  static constexpr int MAX_TILE_RASTERS_PER_FRAME = 8;
+  static constexpr int MAX_FALLBACK_LEVELS = 4;
+  static constexpr int LINE_SCALE_STEPS = 8;
+  // Appending more lines than this is cheaper to handle by dropping the tiles than by patching them.
+  static constexpr size_t MAX_APPENDED_LINES = 4096;
+
+  unordered_map<TileKey, Tile, TileKeyHash> tiles{};
+  // Watermark of the history that is already rasterized into the cached tiles.
+  size_t drawnHistorySize{0};
+  unsigned int drawnHistoryGeneration{0};
+
+  LineMode lineMode{LineMode::Analytic};
+  LineShader lineShader{};
+
+  unsigned long frame{0};
+  int lastLevel{0};
+  int lastRasterCount{0};
+  int lastFallbackCount{0};
+  int lastMissingCount{0};
+
+  // Drops or patches the cached tiles after the history changed.
+  void sync(VM const &vm, HistoryIndex &index) {
+    bool isAppendOnly = drawnHistoryGeneration == vm.historyGeneration && drawnHistorySize <= vm.history.size();
+    size_t appendedCount = vm.history.size() - (isAppendOnly ? drawnHistorySize : 0);
+
+    if (index.needsRebuild(vm)) index.build(vm);
+
+    if (!isAppendOnly || appendedCount > MAX_APPENDED_LINES) {
+      clear();
+    } else if (appendedCount > 0) {
+      // When history only grew since the last draw (eg: REPL commands) it's enough to rasterize the new lines on top.
+      for (auto &[key, tile] : tiles) {
+        Rectangle area = tileArea(key, index.maxThickness * tile.lineScale);
+        bool isDrawing{false};
+
+        for (size_t i = drawnHistorySize; i < vm.history.size(); i++) {
+          auto const &line = vm.history[i];
+          if (!HistoryIndex::overlaps(HistoryIndex::lineBounds(line), area)) continue;
+
+          if (!isDrawing) {
+            beginLines(tile);
+            isDrawing = true;
+          }
+          drawLine(key, line, tile.lineScale);
+        }
+
+        if (isDrawing) endLines();
+      }
+    }
+
+    drawnHistorySize = vm.history.size();
+    drawnHistoryGeneration = vm.historyGeneration;
+  }
+
+  // Rasterizes the missing visible tiles of the current zoom level. Has to be called outside of Begin/EndDrawing.
+  void update(VM const &vm, HistoryIndex const &index, Camera2D const &camera, int screenW, int screenH) {
+    frame++;
+    lastRasterCount = 0;
+
+    if (lineMode == LineMode::Analytic && !lineShader.load()) lineMode = LineMode::Supersampled;
+
+    int level = levelForZoom(camera.zoom);
+    lastLevel = level;
+    double tileWorld = tileWorldSize(level);
+    float lineScale = lineScaleForZoom(camera.zoom, level);
+
+    Vector2 topLeft = GetScreenToWorld2D(Vector2{0.f, 0.f}, camera);
+    Vector2 bottomRight = GetScreenToWorld2D(Vector2{(float)screenW, (float)screenH}, camera);
+    int tx0 = (int)floor(topLeft.x / tileWorld);
+    int ty0 = (int)floor(topLeft.y / tileWorld);
+    int tx1 = (int)floor(bottomRight.x / tileWorld);
+    int ty1 = (int)floor(bottomRight.y / tileWorld);
+
+    visibleTiles.clear();
+    for (int ty = ty0; ty <= ty1; ty++) {
+      for (int tx = tx0; tx <= tx1; tx++) {
+        TileKey key{level, tx, ty};
+        visibleTiles.push_back(key);
+
+        auto it = tiles.find(key);
+        bool isCurrent = it != tiles.end() && it->second.lineScale == lineScale;
+        if (!isCurrent && lastRasterCount < MAX_TILE_RASTERS_PER_FRAME) rasterize(vm, index, key, lineScale);
+      }
+    }
+
+    evict();
+  }
+
+  void draw(Camera2D const &camera) {
+    lastFallbackCount = 0;
+    lastMissingCount = 0;
+
+    for (auto key : visibleTiles) {
+      Rectangle dest = screenRect(key, camera);
+
+      auto it = tiles.find(key);
+      if (it != tiles.end()) {
+        it->second.lastUsedFrame = frame;
+        float texSize = (float)it->second.texture.texture.width;
+        DrawTexturePro(it->second.texture.texture, Rectangle{0.f, 0.f, texSize, texSize}, dest, Vector2Zero(), 0.f,
+                       WHITE);
+      } else if (drawFallback(key, dest)) {
+        lastFallbackCount++;
+      } else {
+        lastMissingCount++;
+      }
+    }
+  }
+
+  void clear() {
+    for (auto &[key, tile] : tiles) unloadTileTexture(tile.texture);
+    tiles.clear();
+  }
+
+  // Releases the GPU resources, before the window closes.
+  void unload() {
+    clear();
+    lineShader.unload();
+  }
+
+  void setLineMode(LineMode mode) {
+    if (mode == lineMode) return;
+    lineMode = mode;
+    clear();
+  }
+
+  int levelForZoom(float zoom) const {
+    // Native sized tiles would look blurry magnified, the supersampled ones have the room for it.
+    float level = lineMode == LineMode::Analytic ? ceilf(log2f(zoom) - 1e-3f) : roundf(log2f(zoom));
+    return toRange((int)level, MIN_LEVEL, MAX_LEVEL);
+  }
+
+  float lineScaleForZoom(float zoom, int level) const {
+    if (lineMode != LineMode::Analytic) return 1.f;
+    float octaves = toRange((float)level - log2f(zoom), 0.f, 1.f);
+    return exp2f(roundf(octaves * LINE_SCALE_STEPS) / LINE_SCALE_STEPS);
+  }
+
+  float textureScale() const {
+    return lineMode == LineMode::Analytic ? 1.f : DRAW_TEXTURE_SCALE;
+  }
+
+  static double tileWorldSize(int level) {
+    return TILE_SIZE / exp2((double)level);
+  }
+
+ private:
+  vector<unsigned int> tileLines{};
+  vector<TileKey> visibleTiles{};
+
+  // World area a tile has to draw, including the lines that stick in from the neighbours with their thickness.
+  static Rectangle tileArea(TileKey key, float maxThickness) {
+    double tileWorld = tileWorldSize(key.level);
+    double margin = maxThickness / 2.0 / exp2((double)key.level);
+    return Rectangle{(float)(key.x * tileWorld - margin), (float)(key.y * tileWorld - margin),
+                     (float)(tileWorld + margin * 2.0), (float)(tileWorld + margin * 2.0)};
+  }
+
+  static Rectangle screenRect(TileKey key, Camera2D const &camera) {
+    double tileWorld = tileWorldSize(key.level);
+    // Rounding both edges the same way keeps neighbouring tiles seamless.
+    double x0 = round((key.x * tileWorld - camera.target.x) * camera.zoom + camera.offset.x);
+    double y0 = round((key.y * tileWorld - camera.target.y) * camera.zoom + camera.offset.y);
+    double x1 = round(((key.x + 1) * tileWorld - camera.target.x) * camera.zoom + camera.offset.x);
+    double y1 = round(((key.y + 1) * tileWorld - camera.target.y) * camera.zoom + camera.offset.y);
+    return Rectangle{(float)x0, (float)y0, (float)(x1 - x0), (float)(y1 - y0)};
+  }
+
+  // Replaces the tile of `key` if it's cached.
+  void rasterize(VM const &vm, HistoryIndex const &index, TileKey key, float lineScale) {
+    lastRasterCount++;
+
+    auto it = tiles.find(key);
+    if (it != tiles.end()) {
+      unloadTileTexture(it->second.texture);
+      tiles.erase(it);
+    }
+
+    int texSize = (int)(TILE_SIZE * textureScale());
+    Tile tile{loadTileTexture(texSize), frame, lineScale};
+    SetTextureFilter(tile.texture.texture, TEXTURE_FILTER_TRILINEAR);
+
+    index.query(vm, tileArea(key, index.maxThickness * lineScale), tileLines);
+
+    BeginTextureMode(tile.texture);
+    ClearBackground(WHITE);
+    EndTextureMode();
+
+    beginLines(tile);
+    for (auto i : tileLines) drawLine(key, vm.history[i], lineScale);
+    endLines();
+
+    tiles.emplace(key, tile);
+  }
+
+  void beginLines(Tile const &tile) const {
+    BeginTextureMode(tile.texture);
+    if (lineMode == LineMode::Analytic) lineShader.begin();
+  }
+
+  void endLines() const {
+    if (lineMode == LineMode::Analytic) lineShader.end();
+    EndTextureMode();
+  }
+
+  void drawLine(TileKey key, Line const &line, float lineScale) const {
+    double tileWorld = tileWorldSize(key.level);
+    float texScale = textureScale();
+    double scale = exp2((double)key.level) * texScale;
+    double originX = key.x * tileWorld;
+    double originY = key.y * tileWorld;
+    float texSize = TILE_SIZE * texScale;
+
+    // Render textures are upside down, hence the flip.
+    Vector2 start{(float)((line.from.x - originX) * scale), (float)(texSize - (line.from.y - originY) * scale)};
+    Vector2 end{(float)((line.to.x - originX) * scale), (float)(texSize - (line.to.y - originY) * scale)};
+
+    if (lineMode == LineMode::Analytic) {
+      lineShader.drawLine(start, end, line.thickness * lineScale, line.color);
+    } else {
+      DrawLineEx(start, end, line.thickness * DRAW_TEXTURE_SCALE, line.color);
+    }
+  }
+
+  // Draws the matching part of the closest cached coarser tile.
+  bool drawFallback(TileKey key, Rectangle dest) {
+    for (int k = 1; k <= MAX_FALLBACK_LEVELS && key.level - k >= MIN_LEVEL; k++) {
+      int div = 1 << k;
+      TileKey ancestorKey{key.level - k, (int)floor((double)key.x / div), (int)floor((double)key.y / div)};
+
+      auto it = tiles.find(ancestorKey);
+      if (it == tiles.end()) continue;
+
+      it->second.lastUsedFrame = frame;
+      float subSize = (float)it->second.texture.texture.width / div;
+      Rectangle source{(key.x - ancestorKey.x * div) * subSize, (key.y - ancestorKey.y * div) * subSize, subSize,
+                       subSize};
+      DrawTexturePro(it->second.texture.texture, source, dest, Vector2Zero(), 0.f, WHITE);
+      return true;
+    }
+
+    return false;
+  }
+
+  // Unloads the least recently used tiles above the limit. Tiles of the current view are always kept.
+  void evict() {
+    if ((int)tiles.size() <= MAX_TILES) return;
+
+    for (auto key : visibleTiles) {
+      auto it = tiles.find(key);
+      if (it != tiles.end()) it->second.lastUsedFrame = frame;
+    }
+
+    vector<pair<unsigned long, TileKey>> candidates{};
+    for (auto &[key, tile] : tiles) {
+      if (tile.lastUsedFrame < frame) candidates.emplace_back(tile.lastUsedFrame, key);
+    }
+    sort(candidates.begin(), candidates.end(), [](auto const &a, auto const &b) { return a.first < b.first; });
+
+    for (auto &[lastUsedFrame, key] : candidates) {
+      if ((int)tiles.size() <= MAX_TILES) break;
+
+      unloadTileTexture(tiles[key].texture);
+      tiles.erase(key);
+    }
+  }
+};
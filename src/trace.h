@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+using namespace std;
+
+// Scoped spans of the app's phases (file watch, parse, execute, rasterize, UI...), exported as Chrome trace
+// events (chrome://tracing, ui.perfetto.dev).
+//
+// Every thread records into its own ring buffer without locking: a span is two clock reads and a store, so tracing is
+// always on and a trace of the last TraceBuffer::CAPACITY spans per thread can be saved at any time. Buffers of
+// finished threads go back to a pool and are reused, their spans are kept. Spans recorded while a trace is being
+// written may be torn, so write it when the workers are idle.
+struct TraceEvent {
+  // A string literal.
+  const char *name;
+  // Nanoseconds since the tracer started.
+  int64_t start;
+  int64_t duration;
+};
+
+struct TraceBuffer {
+  static constexpr size_t CAPACITY = 1 << 14;
+
+  int tid;
+  array<TraceEvent, CAPACITY> events{};
+  // Spans ever written, the ring index is count % CAPACITY.
+  atomic<uint64_t> count{0};
+
+  explicit TraceBuffer(int tid) : tid(tid) {
+  }
+
+  void push(TraceEvent const &event) {
+    uint64_t n = count.load(memory_order_relaxed);
+    events[n % CAPACITY] = event;
+    count.store(n + 1, memory_order_release);
+  }
+};
+
+struct Tracer {
+  atomic<bool> isEnabled{true};
+  chrono::steady_clock::time_point epoch{chrono::steady_clock::now()};
+
+  int64_t now() const {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count();
+  }
+
+  TraceBuffer *acquire() {
+    lock_guard<mutex> lock{buffersMutex};
+    if (!freeBuffers.empty()) {
+      TraceBuffer *buffer = freeBuffers.back();
+      freeBuffers.pop_back();
+      return buffer;
+    }
+    buffers.push_back(make_unique<TraceBuffer>((int)buffers.size() + 1));
+    return buffers.back().get();
+  }
+
+  void release(TraceBuffer *buffer) {
+    lock_guard<mutex> lock{buffersMutex};
+    freeBuffers.push_back(buffer);
+  }
+
+  // Chrome trace event JSON of the spans in the buffers, as complete ("X") events in microseconds. Times are fixed
+  // point with nanosecond digits: spans hours into a session keep their order and nesting.
+  size_t writeChromeJson(ostream &out) {
+    lock_guard<mutex> lock{buffersMutex};
+    ios_base::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+    out << fixed << setprecision(3);
+
+    size_t eventCount{0};
+    out << "{\"traceEvents\": [";
+    for (auto const &buffer : buffers) {
+      uint64_t count = buffer->count.load(memory_order_acquire);
+      uint64_t first = count > TraceBuffer::CAPACITY ? count - TraceBuffer::CAPACITY : 0;
+
+      for (uint64_t i = first; i < count; i++) {
+        TraceEvent const &event = buffer->events[i % TraceBuffer::CAPACITY];
+        out << (eventCount++ == 0 ? "\n" : ",\n") << "{\"name\": \"" << event.name
+            << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->tid << ", \"ts\": " << event.start / 1000.0
+            << ", \"dur\": " << event.duration / 1000.0 << "}";
+      }
+    }
+    out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+
+    out.flags(flags);
+    out.precision(precision);
+    return eventCount;
+  }
+
+ private:
+  mutex buffersMutex{};
+  vector<unique_ptr<TraceBuffer>> buffers{};
+  vector<TraceBuffer *> freeBuffers{};
+};
+
+static Tracer tracer{};
+
+// The calling thread's buffer, taken from the pool on its first span.
+struct ThreadTraceBuffer {
+  TraceBuffer *buffer{nullptr};
+
+  ~ThreadTraceBuffer() {
+    if (buffer != nullptr) tracer.release(buffer);
+  }
+
+  TraceBuffer &get() {
+    if (buffer == nullptr) buffer = tracer.acquire();
+    return *buffer;
+  }
+};
+
+static thread_local ThreadTraceBuffer threadTraceBuffer{};
+
+struct TraceScope {
+  const char *name;
+  int64_t start;
+  bool isActive;
+
+  explicit TraceScope(const char *name) : name(name), isActive(tracer.isEnabled.load(memory_order_relaxed)) {
+    start = isActive ? tracer.now() : 0;
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+  ~TraceScope() {
+    if (isActive) threadTraceBuffer.get().push(TraceEvent{name, start, tracer.now() - start});
+  }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Records a span named `name` (a string literal) from here to the end of the scope.
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__){name}
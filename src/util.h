@@ -1,9 +1,11 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <list>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "raylib.h"
@@ -68,7 +70,27 @@ float randf(float min, float max) {
   return randf() * (max - min) + min;
 }
 
-inline void assert_or_throw(bool cond, string msg) {
+// Reads the whole file into `out` with a single allocation and read.
+bool readFile(const char* path, string& out) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) return false;
+
+  bool isOk = fseek(file, 0, SEEK_END) == 0;
+  long size = isOk ? ftell(file) : -1;
+  isOk = size >= 0 && fseek(file, 0, SEEK_SET) == 0;
+
+  if (isOk) {
+    out.resize(size);
+    out.resize(fread(out.data(), 1, size, file));
+    isOk = ferror(file) == 0;
+  }
+
+  fclose(file);
+  return isOk;
+}
+
+// Not a string message, that would be allocated on every check.
+inline void assert_or_throw(bool cond, const char *msg) {
   if (!cond) [[unlikely]] {
     throw runtime_error(msg);
   }
@@ -83,6 +105,11 @@ struct AppLog {
     refresh();
   }
 
+  void clear() {
+    lines.clear();
+    aggregated.clear();
+  }
+
  private:
   void refresh() {
     aggregated.clear();
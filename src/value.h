@@ -4,6 +4,7 @@
 #include <exception>
 #include <string>
 
+#include "memory_stats.h"
 #include "util.h"
 
 using namespace std;
@@ -34,8 +35,7 @@ struct Value {
   }
 
   explicit Value(string const &v) : kind(ValueKind::String) {
-    strVal = new char[v.length() + 1];
-    strcpy(strVal, v.c_str());
+    strVal = newString(v.c_str(), v.length());
   }
 
   Value &operator=(Value const &other) {
@@ -146,8 +146,17 @@ struct Value {
   }
 
  private:
+  static char *newString(const char *s, size_t length) {
+    memoryStats.add(MemoryKind::Strings, length + 1);
+    char *copy = new char[length + 1];
+    memcpy(copy, s, length + 1);
+    return copy;
+  }
+
   void cleanup() {
-    if (kind == ValueKind::String) delete[] strVal;
+    if (kind != ValueKind::String) return;
+    memoryStats.remove(MemoryKind::Strings, strlen(strVal) + 1);
+    delete[] strVal;
   }
 
   void copy_from(Value const &other) {
@@ -160,8 +169,7 @@ struct Value {
         floatVal = other.floatVal;
         break;
       case ValueKind::String:
-        strVal = new char[strlen(other.strVal) + 1];
-        strcpy(strVal, other.strVal);
+        strVal = newString(other.strVal, strlen(other.strVal));
         break;
       default:
         floatVal = 0.0f;
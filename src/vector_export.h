@@ -0,0 +1,322 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "raylib.h"
+#include "vm.h"
+
+using namespace std;
+
+struct VectorExportOptions {
+  // Coordinates are rounded to multiples of this (in world pixels), fewer digits make smaller files.
+  float precision{0.1f};
+  // Long runs are split so viewers don't need to hold million point paths.
+  int maxRunPoints{4096};
+};
+
+// Walks the history once and turns it into drawing events for the exporters: consecutive lines of the same thickness
+// and color form a group, and connected lines within a group form a run (a polyline).
+template <typename Writer>
+void streamHistoryPaths(LineHistory const &history, VectorExportOptions const &options, Writer &writer) {
+  auto quantize = [&](float v) -> float { return roundf(v / options.precision) * options.precision; };
+  auto sameColor = [](Color a, Color b) -> bool { return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a; };
+
+  bool inGroup{false};
+  bool inRun{false};
+  int runPoints{0};
+  float thickness{};
+  Color color{};
+  Vector2 last{};
+
+  for (auto const &line : history) {
+    Vector2 from{quantize(line.from.x), quantize(line.from.y)};
+    Vector2 to{quantize(line.to.x), quantize(line.to.y)};
+
+    if (!inGroup || line.thickness != thickness || !sameColor(line.color, color)) {
+      if (inRun) writer.endRun();
+      if (inGroup) writer.endGroup();
+
+      thickness = line.thickness;
+      color = line.color;
+      writer.beginGroup(thickness, color);
+      inGroup = true;
+      inRun = false;
+    }
+
+    if (inRun && (from.x != last.x || from.y != last.y || runPoints >= options.maxRunPoints)) {
+      writer.endRun();
+      inRun = false;
+    }
+
+    if (!inRun) {
+      writer.beginRun(from);
+      inRun = true;
+      runPoints = 1;
+      last = from;
+    }
+
+    // Lines that collapse at this precision would only add duplicate points.
+    if (to.x == last.x && to.y == last.y) continue;
+
+    writer.lineTo(to);
+    runPoints++;
+    last = to;
+  }
+
+  if (inRun) writer.endRun();
+  if (inGroup) writer.endGroup();
+}
+
+// Output stream wrapper that formats numbers without allocating and keeps count of the written bytes. Coordinates are
+// written with the decimals of the precision, line widths and color components with ATTRIBUTE_DECIMALS - a coarse
+// precision must not round a thin line to 0 or a color channel to 0 / 1.
+struct ExportStream {
+  static constexpr int ATTRIBUTE_DECIMALS = 3;
+
+  ostream &out;
+  int decimals;
+  size_t written{0};
+
+  ExportStream(ostream &out, float precision) : out(out) {
+    decimals = max(0, (int)ceilf(-log10f(precision) - 1e-4f));
+  }
+
+  void write(string_view s) {
+    out.write(s.data(), s.size());
+    written += s.size();
+  }
+
+  void write(float v) {
+    write(v, decimals);
+  }
+
+  void writeAttribute(float v) {
+    write(v, ATTRIBUTE_DECIMALS);
+  }
+
+  void write(float v, int valueDecimals) {
+    char buf[32];
+    auto [end, ec] = to_chars(buf, buf + sizeof(buf), v, chars_format::fixed, valueDecimals);
+
+    // Trailing zeros (and the dot) carry no information.
+    if (valueDecimals > 0) {
+      while (end[-1] == '0') end--;
+      if (end[-1] == '.') end--;
+    }
+    if (end - buf == 2 && buf[0] == '-' && buf[1] == '0') {
+      buf[0] = '0';
+      end--;
+    }
+
+    write(string_view(buf, end - buf));
+  }
+
+  void write(size_t v) {
+    char buf[24];
+    auto [end, ec] = to_chars(buf, buf + sizeof(buf), v);
+    write(string_view(buf, end - buf));
+  }
+};
+
+struct SvgWriter {
+  ExportStream stream;
+
+  SvgWriter(ostream &out, float precision) : stream(out, precision) {
+  }
+
+  void begin(Vector2 size) {
+    stream.write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"");
+    stream.write(size.x);
+    stream.write("\" height=\"");
+    stream.write(size.y);
+    stream.write("\" viewBox=\"0 0 ");
+    stream.write(size.x);
+    stream.write(" ");
+    stream.write(size.y);
+    stream.write("\">\n<rect width=\"100%\" height=\"100%\" fill=\"white\"/>\n");
+    // Attributes shared by every group are set once.
+    stream.write("<g fill=\"none\" stroke-linecap=\"butt\" stroke-linejoin=\"round\">\n");
+  }
+
+  void end() {
+    stream.write("</g>\n</svg>\n");
+  }
+
+  void beginGroup(float thickness, Color color) {
+    char hex[8];
+    snprintf(hex, sizeof(hex), "#%02x%02x%02x", color.r, color.g, color.b);
+
+    stream.write("<g stroke=\"");
+    stream.write(hex);
+    if (color.a != 255) {
+      stream.write("\" stroke-opacity=\"");
+      stream.writeAttribute(color.a / 255.f);
+    }
+    stream.write("\" stroke-width=\"");
+    stream.writeAttribute(thickness);
+    stream.write("\">\n");
+  }
+
+  void endGroup() {
+    stream.write("</g>\n");
+  }
+
+  void beginRun(Vector2 p) {
+    stream.write("<polyline points=\"");
+    writePoint(p);
+  }
+
+  void lineTo(Vector2 p) {
+    stream.write(" ");
+    writePoint(p);
+  }
+
+  void endRun() {
+    stream.write("\"/>\n");
+  }
+
+ private:
+  void writePoint(Vector2 p) {
+    stream.write(p.x);
+    stream.write(",");
+    stream.write(p.y);
+  }
+};
+
+// Single page, uncompressed PDF. Objects are written in order, the content stream length is an indirect object
+// written after the stream and the xref table comes last - so the whole file is written in one pass.
+struct PdfWriter {
+  ExportStream stream;
+
+  PdfWriter(ostream &out, float precision) : stream(out, precision) {
+  }
+
+  void begin(Vector2 size) {
+    pageHeight = size.y;
+
+    stream.write("%PDF-1.4\n");
+
+    beginObject(1);
+    stream.write("<< /Type /Catalog /Pages 2 0 R >>\n");
+    endObject();
+
+    beginObject(2);
+    stream.write("<< /Type /Pages /Kids [3 0 R] /Count 1 >>\n");
+    endObject();
+
+    beginObject(3);
+    stream.write("<< /Type /Page /Parent 2 0 R /Resources << >> /MediaBox [0 0 ");
+    stream.write(size.x);
+    stream.write(" ");
+    stream.write(size.y);
+    stream.write("] /Contents 4 0 R >>\n");
+    endObject();
+
+    beginObject(4);
+    stream.write("<< /Length 5 0 R >>\nstream\n");
+    contentStart = stream.written;
+
+    // White background, round joins and butt caps.
+    stream.write("1 1 1 rg 0 0 ");
+    stream.write(size.x);
+    stream.write(" ");
+    stream.write(size.y);
+    stream.write(" re f\n1 j 0 J\n");
+  }
+
+  void end() {
+    size_t contentLength = stream.written - contentStart;
+    stream.write("endstream\n");
+    endObject();
+
+    beginObject(5);
+    stream.write(contentLength);
+    stream.write("\n");
+    endObject();
+
+    size_t xrefOffset = stream.written;
+    stream.write("xref\n0 6\n0000000000 65535 f \n");
+    for (auto offset : objectOffsets) {
+      char entry[24];
+      snprintf(entry, sizeof(entry), "%010lu 00000 n \n", offset);
+      stream.write(entry);
+    }
+
+    stream.write("trailer\n<< /Size 6 /Root 1 0 R >>\nstartxref\n");
+    stream.write(xrefOffset);
+    stream.write("\n%%EOF\n");
+  }
+
+  void beginGroup(float thickness, Color color) {
+    stream.writeAttribute(color.r / 255.f);
+    stream.write(" ");
+    stream.writeAttribute(color.g / 255.f);
+    stream.write(" ");
+    stream.writeAttribute(color.b / 255.f);
+    stream.write(" RG ");
+    stream.writeAttribute(thickness);
+    stream.write(" w\n");
+  }
+
+  void endGroup() {
+  }
+
+  void beginRun(Vector2 p) {
+    writePoint(p);
+    stream.write(" m\n");
+  }
+
+  void lineTo(Vector2 p) {
+    writePoint(p);
+    stream.write(" l\n");
+  }
+
+  void endRun() {
+    stream.write("S\n");
+  }
+
+ private:
+  float pageHeight{};
+  size_t contentStart{0};
+  vector<size_t> objectOffsets{};
+
+  void beginObject(int id) {
+    objectOffsets.push_back(stream.written);
+    stream.write(to_string(id));
+    stream.write(" 0 obj\n");
+  }
+
+  void endObject() {
+    stream.write("endobj\n");
+  }
+
+  // PDF's y axis points up.
+  void writePoint(Vector2 p) {
+    stream.write(p.x);
+    stream.write(" ");
+    stream.write(pageHeight - p.y);
+  }
+};
+
+template <typename Writer>
+void exportHistory(LineHistory const &history, Vector2 size, ostream &out, VectorExportOptions const &options) {
+  Writer writer{out, options.precision};
+  writer.begin(size);
+  streamHistoryPaths(history, options, writer);
+  writer.end();
+}
+
+void exportSvg(LineHistory const &history, Vector2 size, ostream &out, VectorExportOptions const &options = {}) {
+  exportHistory<SvgWriter>(history, size, out, options);
+}
+
+void exportPdf(LineHistory const &history, Vector2 size, ostream &out, VectorExportOptions const &options = {}) {
+  exportHistory<PdfWriter>(history, size, out, options);
+}
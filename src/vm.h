@@ -3,27 +3,78 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <mutex>
 #include <numbers>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "ast.h"
+#include "call_culling.h"
+#include "memory_stats.h"
+#include "profiler.h"
 #include "raylib.h"
+#include "sampler.h"
 #include "value.h"
 
 using namespace std;
 
 namespace Ast {
+struct AstStorage;
 struct ExecutableFnNode;
 }  // namespace Ast
 
-struct Frame {
-  unordered_map<string, Value> variables{};
+// Hashes strings of any allocator as their views, so maps keyed by them can be searched with a string_view.
+struct StringViewHash {
+  using is_transparent = void;
+
+  size_t operator()(string_view s) const {
+    return hash<string_view>{}(s);
+  }
+};
+
+// Variables of a call, or of the program for the root frame, counted into `KIND` with their names. They are looked up
+// by view: a name only allocates when it's added (and longer than the inline buffer of a string).
+template <MemoryKind KIND>
+struct BasicFrame {
+  unordered_map<TrackedString<KIND>, Value, StringViewHash, equal_to<>,
+                TrackingAllocator<pair<const TrackedString<KIND>, Value>, KIND>>
+      variables{};
   int loopCount{0};
+
+  BasicFrame() = default;
+  template <MemoryKind OTHER>
+  explicit BasicFrame(BasicFrame<OTHER> const &other) : loopCount(other.loopCount) {
+    variables.reserve(other.variables.size());
+    for (auto const &[name, value] : other.variables) variables.try_emplace(TrackedString<KIND>{name}, value);
+  }
+
+  // The variable `name`, undefined if it's new.
+  Value &variable(string_view name) {
+    auto it = variables.find(name);
+    if (it == variables.end()) it = variables.try_emplace(TrackedString<KIND>{name}).first;
+    return it->second;
+  }
+
+  bool hasVariable(string_view name) const {
+    return variables.contains(name);
+  }
 };
 
+using Frame = BasicFrame<MemoryKind::Frames>;
+
+using FrameStack = vector<Frame, TrackingAllocator<Frame, MemoryKind::Frames>>;
+using ValueStack = vector<Value, TrackingAllocator<Value, MemoryKind::Stack>>;
+
 struct Line {
   Vector2 from;
   Vector2 to;
@@ -35,6 +86,8 @@ struct Line {
   }
 };
 
+using LineHistory = vector<Line, TrackingAllocator<Line, MemoryKind::History>>;
+
 struct IntVar {
   int min;
   int max;
@@ -45,20 +98,97 @@ struct FloatVar {
   float max;
 };
 
+// Counts the memory of the VM states kept for resuming programs, see VM::checkpoints.
+template <typename T>
+using CheckpointAllocator = TrackingAllocator<T, MemoryKind::Checkpoints>;
+
+template <typename T>
+using CheckpointMap =
+    unordered_map<string, T, hash<string>, equal_to<string>, CheckpointAllocator<pair<const string, T>>>;
+
+// What the program defined so far. Rarely changes during a run, so the checkpoints taken while it doesn't share one
+// copy.
+struct Definitions {
+  CheckpointMap<shared_ptr<Ast::ExecutableFnNode>> functions;
+  CheckpointMap<IntVar> intVars;
+  CheckpointMap<FloatVar> floatVars;
+};
+
+// State of the VM before top-level statement `statement` of the program (see Ast::Program::executeFrom).
+struct Checkpoint {
+  size_t statement;
+  Vector2 pos;
+  float angle;
+  bool isDown;
+  float thickness;
+  Color color;
+  size_t historySize;
+  unsigned int historyGeneration;
+  BasicFrame<MemoryKind::Checkpoints> rootFrame;
+  shared_ptr<Definitions const> definitions;
+  vector<Value, CheckpointAllocator<Value>> stack;
+};
+
+// Thrown by the VM when a run drew its line budget, it ends the run (see VM::lineBudget).
+struct LineBudgetReached {};
+
 struct VM {
+  // Most top-level statements between two checkpoints, see Ast::Program::executeFrom.
+  static constexpr size_t CHECKPOINT_INTERVAL = 64;
+
   Vector2 pos{};
   float angle = 0.0f;
   bool isDown = true;
   float thickness = 1.0;
   Color color = BLACK;
+  // Size of the world canvas the turtle starts in the middle of (and `winw()` / `winh()` report). It's decoupled from
+  // the window, which is only a camera over the world.
+  Vector2 worldSize{};
 
-  vector<Frame> frames{};
-  vector<Line> history{};
+  FrameStack frames{};
+  // Frames of returned calls, reused by the next calls with their variables (see pushFrame).
+  FrameStack spareFrames{};
+  LineHistory history{};
+  // Bumped whenever history is dropped (not just appended to) so renderers can tell a growing history from a new one.
+  unsigned int historyGeneration{0};
+  // A function is unset by resetting its pointer, see reset().
   unordered_map<string, shared_ptr<Ast::ExecutableFnNode>> functions{};
+  // Bumped whenever functions, intVars or floatVars change.
+  uint64_t definitionsVersion{0};
+  // The program being executed, the functions it defines share it.
+  shared_ptr<Ast::AstStorage> runningProgram{};
 
   unordered_map<string, IntVar> intVars{};
   unordered_map<string, FloatVar> floatVars{};
-  vector<Value> stack{};
+  ValueStack stack{};
+  // Arguments of the calls being made, see Ast::FnCallNode::eval.
+  ValueStack argValues{};
+
+  // Recorded while executing a program with checkpoints: the VM state before some of the top-level statements, by
+  // statement, and the first top-level statement that read or assigned each root frame variable. Changing a root
+  // variable can only affect the program from that statement on.
+  bool isCheckpointing{false};
+  // False if the last checkpointed execution didn't run to the end.
+  bool isCheckpointComplete{false};
+  // Top-level statements of the program of the last complete checkpointed execution.
+  size_t checkpointedStatementCount{0};
+  size_t currentStatement{0};
+  vector<Checkpoint, CheckpointAllocator<Checkpoint>> checkpoints{};
+  CheckpointMap<size_t> firstRootAccess{};
+  // Taken at definitionsVersion `definitionsSnapshotVersion`.
+  shared_ptr<Definitions const> definitionsSnapshot{};
+  uint64_t definitionsSnapshotVersion{0};
+
+  CallCulling culling{};
+  // Runs end once they drew this many lines, for drafts.
+  size_t lineBudget{SIZE_MAX};
+  // History size when the running program started, the lines after it count into the budget.
+  size_t runHistoryStart{0};
+  Profiler profiler{};
+  // The user function calls being executed, innermost last, see Sampler.
+  vector<ShadowFrame> shadowStack{};
+  // Statements executed since the VM was created, for benchmarks.
+  uint64_t executedStatements{0};
 
   VM() {
     frames.emplace_back();
@@ -74,30 +204,173 @@ struct VM {
     // Risk: base frame is always kept as is - assuming that initialization of a
     // used variable must happen always. As well this keeps preset variables the
     // same at a cost of persisting state between resets.
-    while (frames.size() > 1) frames.pop_back();
+    while (frames.size() > 1) popFrame();
     assert(frames.size() == 1);
 
-    functions.clear();
+    // Keeps the entries, so executing the program again doesn't allocate them.
+    for (auto &[name, fn] : functions) fn.reset();
     intVars.clear();
     floatVars.clear();
+    definitionsVersion++;
     stack.clear();
+    argValues.clear();
 
     if (clearState) {
       history.clear();
+      runHistoryStart = 0;
+      historyGeneration++;
       angle = 0.0f;
       isDown = true;
-      pos.x = GetScreenWidth() >> 1;
-      pos.y = GetScreenHeight() >> 1;
+      pos.x = (int)worldSize.x >> 1;
+      pos.y = (int)worldSize.y >> 1;
+    }
+  }
+
+  // The frame of a call. Once the VM is warmed up, a frame and its variables are reused instead of allocated: the
+  // variables of a spare frame are kept, undefined, which a frame can't tell apart from missing ones.
+  Frame &pushFrame() {
+    if (spareFrames.empty()) return frames.emplace_back();
+
+    Frame &frame = frames.emplace_back(std::move(spareFrames.back()));
+    spareFrames.pop_back();
+    for (auto &[name, value] : frame.variables) value = Value{};
+    frame.loopCount = 0;
+    return frame;
+  }
+
+  void popFrame() {
+    spareFrames.push_back(std::move(frames.back()));
+    frames.pop_back();
+  }
+
+  // The function defined as `name`, null if there is none.
+  Ast::ExecutableFnNode *function(string const &name) const {
+    auto it = functions.find(name);
+    return it == functions.end() ? nullptr : it->second.get();
+  }
+
+  void noteRootAccess(string const &name) {
+    if (isCheckpointing && frames.size() == 1) firstRootAccess.try_emplace(name, currentStatement);
+  }
+
+  void saveCheckpoint(size_t statement) {
+    if (definitionsSnapshot == nullptr || definitionsSnapshotVersion != definitionsVersion) {
+      definitionsSnapshot = allocate_shared<Definitions const>(
+          CheckpointAllocator<Definitions>{},
+          Definitions{{functions.begin(), functions.end()}, {intVars.begin(), intVars.end()},
+                      {floatVars.begin(), floatVars.end()}});
+      definitionsSnapshotVersion = definitionsVersion;
+    }
+    checkpoints.push_back(Checkpoint{statement, pos, angle, isDown, thickness, color, history.size(),
+                                     historyGeneration, BasicFrame<MemoryKind::Checkpoints>{frames.front()},
+                                     definitionsSnapshot, {stack.begin(), stack.end()}});
+  }
+
+  // Rolls the VM back to the last checkpoint taken before top-level statement `statement` or an earlier one, and
+  // returns the statement it was taken before. Fails if there is no such checkpoint or the history was cleared since
+  // it was taken.
+  optional<size_t> restoreCheckpoint(size_t statement) {
+    if (!isCheckpointComplete) return nullopt;
+
+    auto it = upper_bound(
+        checkpoints.begin(), checkpoints.end(), statement,
+        [](size_t statement, Checkpoint const &checkpoint) { return statement < checkpoint.statement; });
+    if (it == checkpoints.begin()) return nullopt;
+    size_t idx = it - checkpoints.begin() - 1;
+
+    Checkpoint const &checkpoint = checkpoints[idx];
+    if (checkpoint.historyGeneration != historyGeneration || checkpoint.historySize > history.size()) return nullopt;
+
+    pos = checkpoint.pos;
+    angle = checkpoint.angle;
+    isDown = checkpoint.isDown;
+    thickness = checkpoint.thickness;
+    color = checkpoint.color;
+    frames.resize(1);
+    frames.front() = Frame{checkpoint.rootFrame};
+    Definitions const &definitions = *checkpoint.definitions;
+    functions = {definitions.functions.begin(), definitions.functions.end()};
+    intVars = {definitions.intVars.begin(), definitions.intVars.end()};
+    floatVars = {definitions.floatVars.begin(), definitions.floatVars.end()};
+    definitionsSnapshot = checkpoint.definitions;
+    definitionsSnapshotVersion = ++definitionsVersion;
+    stack.assign(checkpoint.stack.begin(), checkpoint.stack.end());
+
+    // Dropping lines is a new generation for the renderers, the checkpoints up to this one stay valid in it.
+    history.erase(history.begin() + checkpoint.historySize, history.end());
+    unsigned int prevGeneration = historyGeneration++;
+    for (size_t i = 0; i <= idx; i++) {
+      if (checkpoints[i].historyGeneration == prevGeneration) checkpoints[i].historyGeneration = historyGeneration;
+    }
+
+    return checkpoint.statement;
+  }
+
+  // Moves the drawing of the last checkpointed execution as if it had started from `newStart` / `newAngle`: every
+  // point p becomes newStart + R(newAngle - startAngle) * (p - start). Only valid for start invariant programs (see
+  // Ast::isStartInvariant) and when the history holds nothing but the output of that execution.
+  bool transformFromStart(Vector2 newStart, float newAngle) {
+    if (!isCheckpointComplete || checkpoints.empty()) return false;
+
+    Checkpoint const &start = checkpoints.front();
+    if (start.historyGeneration != historyGeneration || start.historySize != 0) return false;
+
+    float deltaRad = (newAngle - start.angle) * DEG2RAD;
+    float c = cosf(deltaRad);
+    float s = sinf(deltaRad);
+    // p' = R * p + t
+    Vector2 t{newStart.x - (c * start.pos.x - s * start.pos.y), newStart.y - (s * start.pos.x + c * start.pos.y)};
+    auto transform = [&](Vector2 p) -> Vector2 { return Vector2{c * p.x - s * p.y + t.x, s * p.x + c * p.y + t.y}; };
+
+    transformLines(c, s, t);
+
+    float deltaAngle = newAngle - start.angle;
+    auto rotateAngle = [&](float a) -> float { return fmod(fmod(a + deltaAngle, 360) + 360.0f, 360); };
+
+    pos = transform(pos);
+    angle = rotateAngle(angle);
+
+    // Dropped and re-added lines for the renderers.
+    unsigned int prevGeneration = historyGeneration++;
+    for (auto &checkpoint : checkpoints) {
+      checkpoint.pos = transform(checkpoint.pos);
+      checkpoint.angle = rotateAngle(checkpoint.angle);
+      if (checkpoint.historyGeneration == prevGeneration) checkpoint.historyGeneration = historyGeneration;
     }
+    // The start is exact, not rounded through the transform.
+    checkpoints.front().pos = newStart;
+    checkpoints.front().angle = newAngle;
+
+    return true;
+  }
+
+  // First top-level statement that accessed any of the root variables in `names`, nullopt if none did.
+  optional<size_t> firstStatementAccessing(vector<string> const &names) const {
+    optional<size_t> first{nullopt};
+    for (auto const &name : names) {
+      auto it = firstRootAccess.find(name);
+      if (it != firstRootAccess.end() && (!first.has_value() || it->second < first.value())) first = it->second;
+    }
+    return first;
   }
 
   void forward(float v) {
     Vector2 prevPos{pos};
+    culling.maxForward = max(culling.maxForward, fabsf(v));
 
     pos.x += sinf(rad()) * v;
     pos.y += cosf(rad()) * -v;
 
-    if (isDown) history.emplace_back(prevPos, pos, thickness, color);
+    if (isDown) {
+      spendLine();
+      history.emplace_back(prevPos, pos, thickness, color);
+      if (culling.isLearning()) culling.extent.addLine(prevPos, pos, thickness);
+    }
+  }
+
+  // Called before the running program draws a line, ends the run if it drew its budget.
+  void spendLine() const {
+    if (history.size() - runHistoryStart >= lineBudget) throw LineBudgetReached{};
   }
 
   void backward(float v) {
@@ -118,6 +391,29 @@ struct VM {
     pos.y = y;
   }
 
+  // Line is {from.x, from.y, to.x, to.y, thickness, color}: both points of a line are transformed in one 4 lane op.
+  void transformLines(float c, float s, Vector2 t) {
+    static_assert(offsetof(Line, from) == 0 && offsetof(Line, to) == sizeof(float) * 2);
+
+#if defined(__SSE2__)
+    const __m128 cos4 = _mm_set1_ps(c);
+    const __m128 sin4 = _mm_set_ps(s, -s, s, -s);
+    const __m128 t4 = _mm_set_ps(t.y, t.x, t.y, t.x);
+
+    for (auto &line : history) {
+      float *p = &line.from.x;
+      __m128 xy = _mm_loadu_ps(p);
+      __m128 yx = _mm_shuffle_ps(xy, xy, _MM_SHUFFLE(2, 3, 0, 1));
+      _mm_storeu_ps(p, _mm_add_ps(_mm_add_ps(_mm_mul_ps(xy, cos4), _mm_mul_ps(yx, sin4)), t4));
+    }
+#else
+    for (auto &line : history) {
+      line.from = Vector2{c * line.from.x - s * line.from.y + t.x, s * line.from.x + c * line.from.y + t.y};
+      line.to = Vector2{c * line.to.x - s * line.to.y + t.x, s * line.to.x + c * line.to.y + t.y};
+    }
+#endif
+  }
+
   float rad() const {
     return angle * DEG2RAD;
   }